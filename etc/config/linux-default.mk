@@ -2,8 +2,9 @@ DRIVERS_ENABLE:=pulse ossmidi alsa
 CC:=gcc -c -MMD -O2 -Isrc -I$(MIDDIR) -Werror -Wimplicit
 AR:=ar rc
 LD:=gcc
-LDPOST:=-lpulse -lpulse-simple -lpthread -lm -lasound
+HOSTCC:=gcc
+LDPOST:=-lpulse -lpulse-simple -lpthread -lm -lasound -lrt
 
 # Disable drivers, eg if you want to get a clearer picture of memory usage.
 #DRIVERS_ENABLE:=
-#LDPOST:=-lm
+#LDPOST:=-lm -lpthread -lrt
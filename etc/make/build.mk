@@ -23,6 +23,18 @@ OFILES_ENCHILADA:=$(OFILES_BBA) $(OFILES_BBB) $(OFILES_DRIVER) $(OFILES_SHARE)
 
 $(MIDDIR)/%.o:src/%.c;$(PRECMD) $(CC) -o $@ $<
 
+#--------------------------------------------------
+# Generate constant tables with a host tool.
+# Without HOSTCC, the synthesizer computes these at runtime instead.
+
+ifneq (,$(strip $(HOSTCC)))
+  TOOL_MKTABLES:=$(MIDDIR)/tool/mktables
+  GENERATED_TABLES:=$(MIDDIR)/bbb/bbb_wave_tables.h
+  $(TOOL_MKTABLES):etc/tool/mktables.c src/bbb/synth/bbb_wave_generate.c src/bbb/bbb.h;$(PRECMD) $(HOSTCC) -Isrc -o $@ $< -lm
+  $(GENERATED_TABLES):$(TOOL_MKTABLES);$(PRECMD) $(TOOL_MKTABLES) >$@
+  $(MIDDIR)/bbb/synth/bbb_wave_generate.o:$(GENERATED_TABLES)
+endif
+
 #--------------------------------------------------
 # Generate demo data.
 
@@ -0,0 +1,35 @@
+/* mktables.c
+ * Build-time generator for BBB's constant tables.
+ * Emits a C header on stdout, which the build places at MIDDIR/bbb/bbb_wave_tables.h.
+ * We compile the real wave generators with tables disabled, so the output is exactly what they would produce at runtime.
+ */
+ 
+#define BBB_WAVE_TABLES_DISABLE 1
+#include "bbb/synth/bbb_wave_generate.c"
+#include <stdlib.h>
+
+static void mktables_emit(const char *name,uint8_t shape) {
+  int16_t v[BBB_WAVE_SIZE];
+  if (bbb_wave_generate_standard(v,shape)<0) {
+    fprintf(stderr,"mktables: Failed to generate shape %d\n",shape);
+    exit(1);
+  }
+  fprintf(stdout,"static const int16_t %s[%d]={\n",name,BBB_WAVE_SIZE);
+  int i=0;
+  for (;i<BBB_WAVE_SIZE;i++) {
+    fprintf(stdout,"%s%d,",(i&15)?"":"  ",v[i]);
+    if ((i&15)==15) fprintf(stdout,"\n");
+  }
+  fprintf(stdout,"};\n");
+}
+
+int main(int argc,char **argv) {
+  fprintf(stdout,"/* bbb_wave_tables.h\n * Generated by etc/tool/mktables.c. Do not edit.\n */\n\n");
+  fprintf(stdout,"#ifndef BBB_WAVE_TABLES_H\n#define BBB_WAVE_TABLES_H\n\n");
+  fprintf(stdout,"#define BBB_WAVE_TABLES_SIZE_BITS %d\n\n",BBB_WAVE_SIZE_BITS);
+  mktables_emit("bbb_wave_table_sine",BBB_SHAPE_SINE);
+  mktables_emit("bbb_wave_table_losquare",BBB_SHAPE_LOSQUARE);
+  mktables_emit("bbb_wave_table_losaw",BBB_SHAPE_LOSAW);
+  fprintf(stdout,"\n#endif\n");
+  return 0;
+}
@@ -16,12 +16,14 @@
 #define BBB_H
 
 #include <stdint.h>
+#include <pthread.h>
 
 struct bbb_context;
 struct bbb_pcm;
 struct bbb_store;
 struct bb_midi_file;
 struct bb_midi_event;
+struct bb_allocator;
 
 /* Context, high level.
  *************************************************************/
@@ -41,11 +43,49 @@ struct bbb_context *bbb_context_new(
   const char *cachepath
 );
 
+/* Same as bbb_context_new(), but synthesize at (internal_rate) and resample to (rate) on the way out.
+ * Everything inside runs at the internal rate: PCMs, envelopes, song positions, and the disk cache.
+ * Rendering at half the output rate halves both memory and printing time, for a little high end.
+ * Zero or equal to (rate) is exactly bbb_context_new().
+ */
+struct bbb_context *bbb_context_new_resampled(
+  int rate,int internal_rate,int chanc,
+  const char *configpath,
+  const char *cachepath
+);
+
+/* New context using another context's store, for several buses at the same rate on separate threads.
+ * All contexts sharing a store use its internal rate, resampling to (rate) if it differs.
+ * Duplicate sounds are printed once and held once. The store locks internally.
+ * Prints run a little at a time wherever they are needed, same as unshared; any context may advance a shared print.
+ * Attach before any of them starts running. The store's owner stays alive until every context sharing it is deleted.
+ */
+struct bbb_context *bbb_context_new_shared(int rate,int chanc,struct bbb_store *store);
+
+/* Allocate with (allocator) during this context's update, idle, voice_on, event, song, and reload calls.
+ * Null to use whatever the calling thread would (see share/bb_alloc.h).
+ * Anything else, including bbb_context_new() and direct store calls, uses the thread's allocator.
+ * Blocks always go back to the allocator they came from; it must outlive the context and its store.
+ */
+int bbb_context_set_allocator(struct bbb_context *context,struct bb_allocator *allocator);
+
+// get_rate() is the internal rate; only update() deals in the output rate.
 int bbb_context_get_rate(const struct bbb_context *context);
+int bbb_context_get_output_rate(const struct bbb_context *context);
 int bbb_context_get_chanc(const struct bbb_context *context);
 
 void bbb_context_update(int16_t *v,int c,struct bbb_context *context);
 
+/* Spend up to (max_us) microseconds advancing printers, from the caller's thread.
+ * If a song is playing, we first start printing sounds for its next few notes.
+ * Call from your main loop when there's time to spare, and the audio callback has less to do.
+ * Finished prints go to the disk cache, same as when printed during update.
+ * Don't hold the driver's lock: Idle only briefly shares state with update, and audio keeps going while it prints.
+ * It looks ahead from where the song was at the last update, play, or seek.
+ * Returns the count of printers still outstanding.
+ */
+int bbb_context_idle(struct bbb_context *context,int max_us);
+
 /* The basic unit at the playback end is the voice.
  * Each voice is a PCM dump with optional loop.
  * Adding a voice returns 0 if success and not releasable, >0 "voiceid" if release required later.
@@ -53,6 +93,14 @@ void bbb_context_update(int16_t *v,int c,struct bbb_context *context);
  */
 int bbb_context_voice_on_sndid(struct bbb_context *context,uint32_t sndid,int sustain);
 int bbb_context_voice_on(struct bbb_context *context,struct bbb_pcm *pcm,int sustain);
+
+/* Start (c) voices at once, eg a chord or an explosion.
+ * Each unique sndid is looked up once, and repeats share one pcm (and printer).
+ * If (voiceidv) is provided, all voices sustain and we write each voiceid there, in the same order as (sndidv).
+ * Silent or unplayable sounds get voiceid zero.
+ * Returns the count of voices started.
+ */
+int bbb_context_voice_on_batch(struct bbb_context *context,const uint32_t *sndidv,int c,int *voiceidv);
 void bbb_context_voice_off(struct bbb_context *context,int voiceid);
 
 /* all_off() to release every currently sustaining voice.
@@ -72,31 +120,93 @@ int bbb_context_play_song(struct bbb_context *context,struct bb_midi_file *file,
 // Weak reference to the current song, null if none.
 struct bb_midi_file *bbb_context_get_song(struct bbb_context *context);
 
+/* Jump to a position in the current song, in frames from its start.
+ * Sustaining song notes are released and channel programs are restored as of the new position.
+ * Skipped events are not played, and no audio is generated for them.
+ * get_song_position() reports the same units, for saving and restoring later. <0 if no song.
+ */
+int bbb_context_seek_song(struct bbb_context *context,int frame);
+int bbb_context_get_song_position(const struct bbb_context *context);
+
+/* Song playback speed, as a u16.16 multiplier: 0x10000 is normal, 0x20000 twice as fast.
+ * Takes effect immediately and stays in effect for later songs. Clamped to 1/16..16.
+ * Song position stays in unscaled units, so it's still good for seeking after a tempo change.
+ * get_song_usperqnote() is the current tempo as heard: As written in the song, adjusted by our multiplier.
+ */
+int bbb_context_set_tempo(struct bbb_context *context,int tempo);
+int bbb_context_get_tempo(const struct bbb_context *context);
+int bbb_context_get_song_usperqnote(const struct bbb_context *context);
+
+/* Premix the current song's whole loop and play it as a single voice from here on.
+ * Costs one song's worth of rendering up front (synchronous), then next to nothing per frame.
+ * Song must be repeating, at normal tempo. With a disk cache, the render is saved and later bounces are free.
+ * Bouncing ends when the song changes or tempo changes. Seeking and silence are fine.
+ * Events are still read off the song, just not played.
+ * Rendering uses this context's store and program options, but the disk cache is keyed only by song and archive:
+ * Programs you've replaced or options you've changed at runtime are not reflected in a bounce saved earlier.
+ */
+int bbb_context_bounce_song(struct bbb_context *context);
+
 // If interested, you can also feed events to the context as if they came off a song.
 int bbb_context_event(struct bbb_context *context,const struct bb_midi_event *event);
 
+/* Replace the instrument archive while running.
+ * (path) null to reread the one we have, eg after it changed on disk.
+ * Programs whose encoded bytes didn't change stay as they are, and so do their cached sounds.
+ * Changed programs are replaced and their sounds evicted from memory and from the disk cache.
+ * Voices already playing finish with the old sound. A bounced song goes back to live playback.
+ * Returns the count of programs changed, added, or removed. If anything fails, nothing changes.
+ * Not available with the default config (null path at bbb_context_new), unless you provide (path).
+ * You must hold the driver's lock, if there is one. Other contexts sharing the store keep printing while we decode.
+ */
+int bbb_context_reload_archive(struct bbb_context *context,const char *path);
+
+/* Print only every (interval) semitones for this program, and play the notes between by pitch-shifting.
+ * Applies to whatever program is installed at (pid), which may serve other pids too.
+ * Zero or one to print every note, that's the default. Up to 12.
+ * Cuts memory and printing time a lot, at some cost in quality. Only sensible for melodic programs.
+ * Only note events are affected, not voice_on_sndid().
+ */
+int bbb_context_set_program_reuse(struct bbb_context *context,uint8_t pid,int interval);
+
+/* Print this program only at full velocity, and play velocity as a linear gain on the voice.
+ * Same scope as set_program_reuse(). Off by default.
+ * Velocity-sensitive programs print one PCM per note instead of one per note and velocity step.
+ * The cost is that velocity no longer changes the timbre, just the level.
+ */
+int bbb_context_set_program_velocity_gain(struct bbb_context *context,uint8_t pid,int enable);
+
+/* Change the level of a sustaining voice. It ramps there over the next update, so it doesn't click.
+ * u8.8, 0x100 is unity, clamped to 0..0x800. New voices start at unity, or their velocity if the program does that.
+ * Above unity, the voice saturates rather than wrapping if it gets too loud.
+ */
+int bbb_context_set_voice_gain(struct bbb_context *context,int voiceid,int gain);
+
 /* sndid is a combination of (pid,noteid,velocity).
  * But it is normalized first: We may select a different program and eliminate redundant velocity bits.
  * sndid zero is a special value meaning "definitely silent".
  */
 uint32_t bbb_sndid(const struct bbb_context *context,uint8_t pid,uint8_t noteid,uint8_t velocity);
 
-//TODO Tempo tracking?
-
 /* PCM objects for playback.
  * In general, think of PCM objects as immutable.
  * But in practice, the signal might be generated piecemeal the first time it runs.
  *********************************************************/
  
 struct bbb_pcm {
-  int refc;
+  _Atomic int refc; // Atomic because contexts sharing a store hand pcms across threads.
   int c;
   int loopa,loopz; // Sustainable if (a<z). (0<=a<z<=c)
-  int inprogress; // Nonzero if (v) is being asynchronously printed.
+  _Atomic int inprogress; // Nonzero if (v) is being asynchronously printed.
+  _Atomic int readyc; // Frames of (v) printed so far. Same as (c) when not in progress. Never read beyond this.
   uint32_t sndid; // For store's tracking.
   int16_t v[];
 };
 
+/* PCMs living in a store's shared-memory segment have this refc, and ignore ref and del.
+ */
+#define BBB_PCM_REFC_STATIC -0x7fff
+
 void bbb_pcm_del(struct bbb_pcm *pcm);
 int bbb_pcm_ref(struct bbb_pcm *pcm);
 
@@ -113,9 +223,11 @@ struct bbb_printer {
   const struct bbb_program_type *type;
   struct bbb_context *context; // WEAK
   struct bbb_program *program; // STRONG
-  int refc;
+  _Atomic int refc;
   struct bbb_pcm *pcm;
   int p;
+  int failed; // Set when an update fails. The rest of (pcm) stays silent, and we never print again.
+  pthread_mutex_t mtx; // Held through each update. Contexts sharing a store may advance the same printer.
 };
 
 void bbb_printer_del(struct bbb_printer *printer);
@@ -123,7 +235,9 @@ int bbb_printer_ref(struct bbb_printer *printer);
 
 struct bbb_printer *bbb_print(struct bbb_program *program,uint8_t noteid,uint8_t velocity);
 
-// 0 if complete, >0 if more remaining.
+/* 0 if complete, >0 if more remaining.
+ * Safe to call from any thread. If another thread is updating the same printer, we wait for it.
+ */
 int bbb_printer_update(struct bbb_printer *printer,int c);
 
 int bbb_measure_program(const void *src,int srcc);
@@ -235,7 +349,7 @@ void bbb_env_attenuate(struct bbb_env *env,uint8_t master);
 #define BBB_WAVE_FRACTION_SIZE_BITS (32-BBB_WAVE_SIZE_BITS)
 
 struct bbb_wave {
-  int refc;
+  _Atomic int refc;
   int16_t v[BBB_WAVE_SIZE];
 };
 
@@ -266,21 +380,86 @@ void bbb_wave_generate_square(int16_t *v,int c);
 void bbb_wave_generate_saw(int16_t *v,int c,int16_t a,int16_t z);
 void bbb_wave_generate_triangle(int16_t *v,int c);
 
+/* Sine, losquare, or losaw at BBB_WAVE_SIZE, with the parameters we use for the cached ones.
+ * These normally copy out of tables generated at build time, no math at all.
+ */
+int bbb_wave_generate_standard(int16_t *v,uint8_t shape);
+
 /* In general, you don't interact directly with the store.
  * But it can provide you some helpful troubleshooting info:
  *   pcm_count: How many PCMs are cached right now?
  *   print_count: How many PCMs have we printed since startup?
  *   eviction_count: How many times did we evict PCMs since startup? (count of operations, not the count of evicted PCMs).
  *   memory_estimate: Memory size in bytes of the PCM cache. Samples only; actual usage will be a little higher.
+ *   dedup_savings: Bytes not in memory_estimate because identical PCMs are shared. Zero unless you enable dedup.
  * Also, you may change the cache trigger limits. <=1 to leave unchanged and return the current value.
  * "pcm_count_limit" is probably not useful.
+ * Enabling dedup costs a hash of each PCM when its print finishes. Worth it if your programs mask velocity or share notes.
+ * trim_threshold: Finished prints lose any tail at or below this magnitude, before caching.
+ * Default zero trims only exact silence, which costs nothing audible. <0 to disable. Returns the new threshold.
  */
 struct bbb_store *bbb_context_get_store(const struct bbb_context *context);
 int bbb_store_get_pcm_count(const struct bbb_store *store);
 int bbb_store_get_print_count(const struct bbb_store *store);
 int bbb_store_get_eviction_count(const struct bbb_store *store);
 int bbb_store_get_memory_estimate(const struct bbb_store *store);
+int bbb_store_get_dedup_savings(const struct bbb_store *store);
+int bbb_store_set_dedup(struct bbb_store *store,int enable);
+int bbb_store_set_trim_threshold(struct bbb_store *store,int level);
 int bbb_store_set_pcm_count_limit(struct bbb_store *store,int pcmc);
 int bbb_store_set_memory_limit(struct bbb_store *store,int bytec);
 
+/* Eviction priority.
+ * When the cache is full, we evict the lowest priority first, and least recently used among equals.
+ * BBB_PRIORITY_PINNED sounds are never evicted, and don't count against the limits.
+ * So the limits cover only the unpinned portion. memory_estimate still reports everything;
+ * pinned_memory_estimate is the pinned part of it.
+ * Set a priority for one sound (see bbb_sndid()), or for every sound of a program.
+ * Program priority applies to whatever program is installed at (pid), same as bbb_context_set_program_reuse().
+ * A sound gets the higher of its own and its program's.
+ * Nothing is printed or loaded here, just remembered. Pinning a sound does not make it resident.
+ */
+#define BBB_PRIORITY_NORMAL 0
+#define BBB_PRIORITY_PINNED 0xff
+int bbb_store_set_sound_priority(struct bbb_store *store,uint32_t sndid,uint8_t priority);
+int bbb_store_set_program_priority(struct bbb_store *store,uint8_t pid,uint8_t priority);
+int bbb_store_get_pinned_memory_estimate(const struct bbb_store *store);
+
+/* Snapshot the store's resident PCMs to one file, or restore them from it, for a warm start next session.
+ * Save returns the count of PCMs written. Prints in progress are skipped.
+ * Load returns the count of PCMs added, most recently used first until the store's limits are reached.
+ * Snapshots from a different rate or config load nothing, and that's not an error.
+ * Call load after bbb_context_new() and before playing anything.
+ */
+int bbb_store_save_snapshot(struct bbb_store *store,const char *path);
+int bbb_store_load_snapshot(struct bbb_store *store,const char *path);
+
+/* Usage profile: Count requests per sound, and how long each took the first time we didn't have it.
+ * Profiling is off by default. Loading a profile adds to what's recorded so far, so sessions accumulate.
+ * Load and save return the count of sounds in the file. A profile from a different config loads nothing.
+ * bbb_store_prewarm() prints (or reads from the disk cache) the most frequent sounds not yet resident,
+ * until it has (pcmc) of them, or (bytec) more memory, or (max_us) elapsed. Returns the count produced.
+ * It never goes beyond the store's eviction target.
+ * Typical: bbb_context_new(), bbb_store_load_profile(), bbb_store_prewarm(), bbb_store_set_profiling(1), play,
+ * then bbb_store_save_profile() at quit.
+ */
+int bbb_store_set_profiling(struct bbb_store *store,int enable);
+int bbb_store_load_profile(struct bbb_store *store,const char *path);
+int bbb_store_save_profile(struct bbb_store *store,const char *path);
+int bbb_store_prewarm(struct bbb_store *store,int pcmc,int bytec,int max_us);
+
+/* Attach a POSIX shared-memory segment as a second tier under the store, above the disk cache.
+ * Every process attached to the same segment sees every sound any of them printed or read from disk,
+ * and plays it straight out of the segment, no copy.
+ * (name) null for a default derived from the rate and config, so processes that can share do.
+ * (size) <=0 for a default 64 MB. The first process to attach creates it; others take whatever size it has.
+ * Space is never reclaimed: Once full, it stops taking new sounds. Unlink it to start fresh next time.
+ * Fails if the segment exists but was made for a different rate or config.
+ * The segment is readable and writable only by the user who created it. Records that don't fit it are ignored.
+ * Sounds played from the segment don't count in memory_estimate or against the memory limit, only the PCM count.
+ * Attach once, before playing anything. It stays mapped until the context is deleted.
+ */
+int bbb_store_attach_shm(struct bbb_store *store,const char *name,int size);
+int bbb_store_unlink_shm(struct bbb_store *store,const char *name);
+
 #endif
@@ -0,0 +1,97 @@
+#include "bbb_context_internal.h"
+#include "share/bb_fs.h"
+#include "share/bb_serial.h"
+
+/* Cleanup.
+ */
+ 
+void bbb_archive_del(struct bbb_archive *archive) {
+  if (!archive) return;
+  if (archive->refc-->1) return;
+  if (archive->mapped) bb_file_unmap((void*)archive->src,archive->srcc);
+  else if (archive->src) bb_free((void*)archive->src);
+  bb_free(archive);
+}
+
+/* Retain.
+ */
+ 
+int bbb_archive_ref(struct bbb_archive *archive) {
+  if (!archive) return -1;
+  if (archive->refc<1) return -1;
+  if (archive->refc==INT_MAX) return -1;
+  archive->refc++;
+  return 0;
+}
+
+/* New.
+ */
+ 
+struct bbb_archive *bbb_archive_new(const char *path) {
+  if (!path) return 0;
+  struct bbb_archive *archive=bb_calloc(1,sizeof(struct bbb_archive));
+  if (!archive) return 0;
+  archive->refc=1;
+  
+  // Map it if we can. Plain old read if not, eg it's a pipe.
+  void *src=0;
+  int srcc=bb_file_map(&src,path);
+  if (srcc>0) {
+    archive->mapped=1;
+  } else if ((srcc=bb_file_read(&src,path))<0) {
+    bb_free(archive);
+    return 0;
+  }
+  archive->src=src;
+  archive->srcc=srcc;
+  
+  return archive;
+}
+
+/* Build table of contents.
+ * This is the only time we walk the programs sequentially.
+ */
+ 
+int bbb_archive_index(struct bbb_archive *archive) {
+  if (!archive) return -1;
+  memset(archive->tocv,0,sizeof(archive->tocv));
+  const uint8_t *src=archive->src;
+  int srcc=archive->srcc;
+  
+  // Verify signature.
+  if ((srcc<4)||memcmp(src,"\x00\xbb\xbaR",4)) return -1;
+  int srcp=4;
+  
+  // Read programs if the next byte is zero.
+  if ((srcp<srcc)&&!src[srcp]) {
+    int pid=-1;
+    while (srcp<srcc) {
+    
+      // End of program list, if the next pid is out of order.
+      if (src[srcp]<=pid) break;
+      pid=src[srcp++];
+      
+      // Measure program.
+      int programc=bbb_measure_program(src+srcp,srcc-srcp);
+      if (programc<0) return -1;
+      archive->tocv[pid].v=src+srcp;
+      archive->tocv[pid].c=programc;
+      if (bb_md5(archive->tocv[pid].digest,16,src+srcp,programc)!=16) return -1;
+      srcp+=programc;
+    }
+  }
+  
+  // Further content may be defined in the future...
+  
+  if (bb_md5(archive->digest,sizeof(archive->digest),archive->src,archive->srcc)!=sizeof(archive->digest)) return -1;
+  return 0;
+}
+
+/* Get program.
+ */
+ 
+int bbb_archive_get_program(void *dstpp,const struct bbb_archive *archive,uint8_t pid) {
+  if (!archive) return 0;
+  if (dstpp) *(const void**)dstpp=archive->tocv[pid].v;
+  return archive->tocv[pid].c;
+}
@@ -2,14 +2,17 @@
 #define BBB_CONTEXT_INTERNAL_H
 
 #include "bbb/bbb.h"
+#include "share/bb_alloc.h"
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <stdio.h>
+#include <pthread.h>
 
 struct bbb_store;
 struct bbb_voice;
-struct bb_midi_file_reader;
+struct bbb_archive;
+struct bb_midi_timeline_reader;
 
 // Arbitrary sanity limits.
 #define BBB_RATE_MIN    200
@@ -19,17 +22,28 @@ struct bb_midi_file_reader;
 #define BBB_DEFAULT_VOICE_LIMIT 128
 
 #define BBB_CHANNEL_COUNT 16 /* Should match MIDI, ie 16 */
+#define BBB_IDLE_LOOKAHEAD 32 /* Song events. */
 
 /* Context, private API.
  ****************************************************************/
 
 struct bbb_context {
-  int refc;
-  int rate;
+  _Atomic int refc; // Contexts sharing our store hold a reference, and may drop it from any thread.
+  struct bbb_context *home; // STRONG, the owner of (store) if we're sharing someone else's.
+  struct bb_allocator *allocator; // WEAK, optional. See bbb_context_set_allocator().
+  int rate; // Internal rate, everything but update() uses this.
+  int outrate; // Output rate, same as (rate) unless we're resampling.
   int chanc;
   int voice_limit;
   
-  struct bb_midi_file_reader *song;
+  /* Phase increment per frame for each MIDI note, where (1<<32) is one period.
+   * Computed once at construction, so printers never touch floating-point pitch math.
+   */
+  uint32_t notedpv[128];
+  
+  struct bb_midi_timeline_reader *song;
+  int tempo; // u16.16, applies to any song we play
+  struct bbb_pcm *bounce; // Whole song premixed and playing as one voice. Song events are read but not played.
   struct bbb_channel {
     uint8_t pid;
   } channelv[BBB_CHANNEL_COUNT];
@@ -40,8 +54,30 @@ struct bbb_context {
   
   struct bbb_store *store;
   
+  /* bbb_context_idle() runs without the driver's lock, so it only touches what (idlemtx) guards.
+   * That's the printer list, and a copy of the song's next few notes that update() leaves for it.
+   * Hold it briefly, the audio thread takes it every update. Never take the store's lock while holding it.
+   */
+  pthread_mutex_t idlemtx;
+  int idlemtxok;
   struct bbb_printer **printerv;
   int printerc,printera;
+  int idlep; // Next printer for bbb_context_idle(), round-robin.
+  struct bbb_ahead {
+    uint8_t pid,noteid,velocity;
+  } aheadv[BBB_IDLE_LOOKAHEAD];
+  int aheadc;
+  
+  /* Resampler, only if (outrate!=rate).
+   * Linear interpolation, position in 32.32 fixed point.
+   * (rscarryv) are internal samples rendered but not yet passed; the first is the left side of the next interpolation.
+   */
+  uint64_t rsstep;
+  uint32_t rsphase;
+  int16_t rscarryv[2];
+  int rscarryc;
+  int16_t *rsv;
+  int rsa;
 };
 
 /* Voice, private API.
@@ -50,51 +86,161 @@ struct bbb_context {
 struct bbb_voice {
   int voiceid; // 0 if not addressable (ie not sustaining)
   struct bbb_pcm *pcm; // null if not in use
+  struct bbb_printer *printer; // STRONG, only while (pcm) is in progress.
   int p;
+  uint32_t rate; // u16.16 playback speed. BBB_VOICE_RATE_NORMAL to play as printed, otherwise we interpolate.
+  uint32_t pfrac; // Fraction of (p), same units as (rate).
+  int gain; // u8.8, BBB_VOICE_GAIN_UNITY to mix straight.
+  int level; // u8.8, the gain actually applied. Ramps to (gain) over one update, so changes don't click.
   uint8_t chid,noteid; // as specified in a midi event, for context's tracking
 };
 
+#define BBB_VOICE_RATE_NORMAL 0x10000
+#define BBB_VOICE_GAIN_UNITY 0x100
+#define BBB_VOICE_GAIN_MAX 0x800
+
 void bbb_voice_cleanup(struct bbb_voice *voice);
 
-/* Blindly overwrites (voice).
+/* Blindly overwrites (voice). Plays at normal rate and unity gain; you may change (rate,gain) after.
+ * Setting (gain) ramps to it over the next update. Set (level) too for a new voice, to start there directly.
  * Provide a nonzero (voiceid) if you want sustain.
  * We validate against (pcm); if it doesn't support sustain, (voice->voiceid) will be zero.
+ * (printer) is optional, the one producing (pcm) if it's still in progress.
  */
-int bbb_voice_setup(struct bbb_voice *voice,int voiceid,struct bbb_pcm *pcm);
+int bbb_voice_setup(struct bbb_voice *voice,int voiceid,struct bbb_pcm *pcm,struct bbb_printer *printer);
 
 /* Adds to (v), you must clear it initially.
  * If we reach the end, we clear (pcm).
+ * We never read beyond (pcm->readyc). If we have the printer, we advance it as needed.
+ * Without a printer, the voice stalls until someone else prints it.
  */
 void bbb_voice_update(int16_t *v,int c,struct bbb_voice *voice);
 
+/* Archive, private API.
+ * The encoded archive, mapped into memory if possible.
+ * Indexing builds a table of contents: Slices of (src) for each program, keyed by pid.
+ * Program decoders read straight out of the mapping, nothing gets copied.
+ *****************************************************************/
+ 
+struct bbb_archive {
+  _Atomic int refc; // Reload holds the old one outside the store's lock.
+  const uint8_t *src;
+  int srcc;
+  int mapped; // (src) is from bb_file_map(), otherwise from bb_file_read().
+  uint8_t digest[16]; // MD5 of (src), set at index. Identifies this configuration in disk caches.
+  struct bbb_archive_toc {
+    const uint8_t *v; // points into (src)
+    int c; // zero if this pid is absent
+    uint8_t digest[16]; // MD5 of the program, so reload can compare without reading the old (src) again.
+  } tocv[256];
+};
+
+void bbb_archive_del(struct bbb_archive *archive);
+int bbb_archive_ref(struct bbb_archive *archive);
+
+/* Null if we can't read the file.
+ * After creating, you must call bbb_archive_index(), which fails if the archive is malformed.
+ */
+struct bbb_archive *bbb_archive_new(const char *path);
+int bbb_archive_index(struct bbb_archive *archive);
+
+// Length of encoded program, or zero if absent. (*dstpp) is a weak reference into the archive.
+int bbb_archive_get_program(void *dstpp,const struct bbb_archive *archive,uint8_t pid);
+
 /* Store, private API.
  ****************************************************************/
  
 struct bbb_store {
-  struct bbb_context *context; // WEAK
-  int refc;
+  struct bbb_context *context; // WEAK. Its owner; contexts sharing it hold a STRONG ref to this one.
+  _Atomic int refc; // Every context sharing it holds a reference, on its own thread.
+  
+  /* Recursive. Every public entry point locks, including bbb_store_get_pcm() and bbb_store_print_finished().
+   * Printing happens outside it: Printers have their own locks, and contexts on any thread may advance them.
+   * (shared) only stops trim from shrinking pcms in place, since other threads might be playing them.
+   */
+  pthread_mutex_t mtx;
+  int mtxok;
+  int shared;
   
   char *configpath;
   int configpathc;
   char *cachepath;
   int cachepathc;
   
+  struct bbb_archive *archive; // null if we're using defaults
   struct bbb_program *programv[256];
   
+  /* Note-on normalization, rebuilt by bbb_store_set_program().
+   * (routev) is the resolved pid plus one for each requested pid, or zero if nothing plays.
+   * (notev) exists for each installed program: Zero if the note is absent, otherwise 0x100|velocity_mask.
+   */
+  uint16_t routev[256];
+  uint16_t *notev[256];
+  
+  /* Semitones between anchor notes for each installed program, or zero to print every note.
+   * Context plays the others by pitch-shifting the nearest anchor.
+   */
+  uint8_t reusev[256];
+  
+  // Nonzero for each installed program that should print at full velocity, and play velocity as voice gain.
+  uint8_t velgainv[256];
+  
+  /* Eviction priority for each installed program, and for individual sounds, sorted by sndid.
+   * An entry gets the higher of the two. BBB_PRIORITY_PINNED entries are never evicted.
+   */
+  uint8_t priorityv[256];
+  struct bbb_store_priority {
+    uint32_t sndid;
+    uint8_t priority;
+  } *sndpriorityv;
+  int sndpriorityc,sndprioritya;
+  
   struct bbb_store_entry {
     uint32_t sndid;
     struct bbb_pcm *pcm;
+    struct bbb_printer *printer; // STRONG, while (pcm) is being printed. Later requests share it.
     uint32_t access;
+    uint64_t hash; // Content hash if dedup is enabled and the print is finished, otherwise zero.
+    int dup; // (pcm) is shared with another entry, which counts its samples in (pcmtotal).
+    uint8_t priority;
   } *entryv;
   int entryc,entrya;
+  
+  /* Every entry with a nonzero (hash), sorted by hash then sndid.
+   * Dedup looks up candidates here, and so does handing off a count when the original leaves.
+   */
+  struct bbb_store_hash {
+    uint64_t hash;
+    uint32_t sndid;
+  } *hashv;
+  int hashc,hasha;
   uint32_t access_next;
   
   int printc;
   int evictionc;
-  int pcmtotal; // Sum of sample counts of all pcm entries.
+  int pcmtotal; // Sum of sample counts of all distinct pcm entries, pinned or not. Not shared-memory ones.
+  int dedup; // Nonzero to hash finished prints and share identical ones.
+  int trim; // Finished prints lose trailing samples at or below this magnitude. <0 to keep everything.
+  int dedupt; // Samples we would be holding if not for dedup.
   int limit_pcmc,target_pcmc;
   int limit_pcmt,target_pcmt;
   
+  /* Usage profile, if enabled: Every bbb_store_get_pcm() counts a hit, sorted by sndid.
+   * (latency) is the time spent on the first miss, reading or starting the print.
+   */
+  int profile;
+  struct bbb_store_profile {
+    uint32_t sndid;
+    uint32_t hitc;
+    uint32_t latency; // us
+  } *profilev;
+  int profilec,profilea;
+  
+  /* Shared-memory tier, if attached. PCMs from it are BBB_PCM_REFC_STATIC.
+   * Goes (stale) on reload, since other processes may still be using the old config.
+   */
+  struct bbb_shm *shm;
+  
   // No general wave store, but we do keep some common ones ad-hoc.
   struct bbb_wave *wave_sine;
   struct bbb_wave *wave_losquare;
@@ -111,9 +257,23 @@ int bbb_store_load(struct bbb_store *store);
 
 int bbb_store_set_program(struct bbb_store *store,uint8_t pid,const void *src,int srcc);
 
+/* The store's mutex is recursive; lock around any direct access to its fields from a context.
+ * bbb_store_share() switches to synchronous printing, and finishes any prints in progress.
+ */
+void bbb_store_lock(struct bbb_store *store);
+void bbb_store_unlock(struct bbb_store *store);
+int bbb_store_share(struct bbb_store *store);
+
+/* Read a new archive and install only the programs that changed, evicting their sounds.
+ * (path) null to reread the current one. Returns the count of changed programs.
+ * Decodes everything before installing anything, so a failure leaves the store as it was.
+ */
+int bbb_store_reload(struct bbb_store *store,const char *path);
+
 /* Fetch a PCM or generate it.
  * Returns STRONG. The object is probably cached but maybe not.
- * If (printer) provided we populate it with a new (STRONG) printer to generate this pcm.
+ * If (printer) provided we populate it with a STRONG printer to generate this pcm.
+ * That may be a printer we handed out before, if the same sound is still in progress.
  * If you don't provide (printer), or we set it null, the pcm is complete.
  */
 struct bbb_pcm *bbb_store_get_pcm(
@@ -127,13 +287,48 @@ int bbb_store_insert(struct bbb_store *store,int p,uint32_t sndid,struct bbb_pcm
 int bbb_store_replace(struct bbb_store *store,int p,struct bbb_pcm *pcm);
 
 /* Context should call this when a printer finishes.
- * If we are configured with a disk cache, this writes the PCM to it.
+ * We drop the entry's printer, and if we are configured with a disk cache, write the PCM to it.
  */
 int bbb_store_print_finished(struct bbb_store *store,struct bbb_pcm *pcm);
 
+/* STRONG printer of a pcm still in progress, or null.
+ * For voices that got the pcm some other way: Without its printer, they'd stall at (readyc).
+ */
+struct bbb_printer *bbb_store_get_printer(struct bbb_store *store,const struct bbb_pcm *pcm);
+
+/* Bounced songs in the disk cache, keyed by song digest and our archive's.
+ * Get returns STRONG or null. Set does nothing if we have no disk cache.
+ * With the default programs, the digest is of their hard-coded table.
+ */
+struct bbb_pcm *bbb_store_get_bounce(struct bbb_store *store,const uint8_t *songdigest);
+int bbb_store_set_bounce(struct bbb_store *store,const uint8_t *songdigest,const struct bbb_pcm *pcm);
+void bbb_store_get_archive_digest(uint8_t *dst,const struct bbb_store *store);
+
+/* Record a request for (sndid) in the usage profile.
+ * (us) is how long it took if it was a miss, or zero for a hit.
+ */
+void bbb_store_profile_hit(struct bbb_store *store,uint32_t sndid,int us);
+
+// Microseconds on a monotonic clock, for profiling and idle deadlines.
+int64_t bbb_store_now_us(void);
+
+/* Shared-memory segment, see bbb_store_shm.c.
+ * Get returns a WEAK pcm living in the segment, or null. It's valid until bbb_shm_del().
+ * Put copies a finished pcm into the segment if there's room and nobody already did.
+ */
+struct bbb_shm {
+  uint8_t *v;
+  uint64_t size;
+  int stale;
+};
+void bbb_shm_del(struct bbb_shm *shm);
+struct bbb_pcm *bbb_shm_get(struct bbb_shm *shm,uint32_t sndid);
+int bbb_shm_put(struct bbb_shm *shm,uint32_t sndid,const struct bbb_pcm *pcm);
+
 /* Any program that isn't populated, make something up.
  * (may leave programs unset too).
  */
 int bbb_store_load_default(struct bbb_store *store);
+void bbb_store_get_default_digest(uint8_t *dst);
 
 #endif
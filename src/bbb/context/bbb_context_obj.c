@@ -1,5 +1,7 @@
 #include "bbb_context_internal.h"
 #include "share/bb_midi.h"
+#include "share/bb_pitch.h"
+#include "share/bb_serial.h"
 
 /* Cleanup.
  */
@@ -8,24 +10,31 @@ void bbb_context_del(struct bbb_context *context) {
   if (!context) return;
   if (context->refc-->1) return;
 
-  bb_midi_file_reader_del(context->song);
-  bbb_store_del(context->store);
+  bb_midi_timeline_reader_del(context->song);
+  bbb_pcm_del(context->bounce);
   
+  // Voices and printers before the store: Their pcms might live in its shared-memory segment.
   if (context->voicev) {
     while (context->voicec-->0) {
       bbb_voice_cleanup(context->voicev+context->voicec);
     }
-    free(context->voicev);
+    bb_free(context->voicev);
   }
   
   if (context->printerv) {
     while (context->printerc-->0) {
       bbb_printer_del(context->printerv[context->printerc]);
     }
-    free(context->printerv);
+    bb_free(context->printerv);
   }
   
-  free(context);
+  bbb_store_del(context->store);
+  bbb_context_del(context->home);
+  
+  if (context->rsv) bb_free(context->rsv);
+  if (context->idlemtxok) pthread_mutex_destroy(&context->idlemtx);
+  
+  bb_free(context);
 }
 
 /* Retain.
@@ -39,6 +48,27 @@ int bbb_context_ref(struct bbb_context *context) {
   return 0;
 }
 
+/* Allocator.
+ * Entry points that might allocate run with the context's allocator as the thread's override, if it has one.
+ */
+ 
+int bbb_context_set_allocator(struct bbb_context *context,struct bb_allocator *allocator) {
+  if (!context) return -1;
+  if (allocator&&!allocator->malloc) return -1;
+  context->allocator=allocator;
+  return 0;
+}
+
+static struct bb_allocator *bbb_context_enter(struct bbb_context *context) {
+  if (!context||!context->allocator) return 0;
+  return bb_use_allocator(context->allocator);
+}
+
+static void bbb_context_leave(struct bbb_context *context,struct bb_allocator *pvallocator) {
+  if (!context||!context->allocator) return;
+  bb_use_allocator(pvallocator);
+}
+
 /* New.
  */
 
@@ -47,18 +77,48 @@ struct bbb_context *bbb_context_new(
   const char *configpath,
   const char *cachepath
 ) {
+  return bbb_context_new_resampled(rate,rate,chanc,configpath,cachepath);
+}
+
+static struct bbb_context *bbb_context_new_bare(int outrate,int rate,int chanc) {
   if ((rate<BBB_RATE_MIN)||(rate>BBB_RATE_MAX)) return 0;
+  if ((outrate<BBB_RATE_MIN)||(outrate>BBB_RATE_MAX)) return 0;
   if ((chanc<BBB_CHANC_MIN)||(chanc>BBB_CHANC_MAX)) return 0;
   
-  struct bbb_context *context=calloc(1,sizeof(struct bbb_context));
+  struct bbb_context *context=bb_calloc(1,sizeof(struct bbb_context));
   if (!context) return 0;
   
   context->refc=1;
   context->rate=rate;
+  context->outrate=outrate;
+  context->rsstep=((uint64_t)rate<<32)/outrate;
+  context->rscarryc=1;
   context->chanc=chanc;
   context->voiceid_next=1;
   context->voice_limit=BBB_DEFAULT_VOICE_LIMIT;
+  context->tempo=BB_MIDI_TEMPO_NORMAL;
+  
+  int i=128; while (i-->0) {
+    context->notedpv[i]=(bb_hz_from_noteidv[i]*4294967296.0)/rate;
+  }
   
+  if (pthread_mutex_init(&context->idlemtx,0)) {
+    bbb_context_del(context);
+    return 0;
+  }
+  context->idlemtxok=1;
+  
+  return context;
+}
+
+struct bbb_context *bbb_context_new_resampled(
+  int outrate,int rate,int chanc,
+  const char *configpath,
+  const char *cachepath
+) {
+  if (!rate) rate=outrate;
+  struct bbb_context *context=bbb_context_new_bare(outrate,rate,chanc);
+  if (!context) return 0;
   if (!(context->store=bbb_store_new(context,configpath,cachepath))) {
     bbb_context_del(context);
     return 0;
@@ -67,7 +127,32 @@ struct bbb_context *bbb_context_new(
     bbb_context_del(context);
     return 0;
   }
-  
+  return context;
+}
+
+/* New context sharing another's store.
+ * Programs point to the store's owner context, for its rate and pitch tables, so we keep it alive.
+ */
+ 
+struct bbb_context *bbb_context_new_shared(int rate,int chanc,struct bbb_store *store) {
+  if (!store||!store->context) return 0;
+  struct bbb_context *home=store->context;
+  struct bbb_context *context=bbb_context_new_bare(rate,home->rate,chanc);
+  if (!context) return 0;
+  if (bbb_context_ref(home)<0) {
+    bbb_context_del(context);
+    return 0;
+  }
+  context->home=home;
+  if (bbb_store_ref(store)<0) {
+    bbb_context_del(context);
+    return 0;
+  }
+  context->store=store;
+  if (bbb_store_share(store)<0) {
+    bbb_context_del(context);
+    return 0;
+  }
   return context;
 }
 
@@ -76,7 +161,7 @@ struct bbb_context *bbb_context_new(
  
 struct bb_midi_file *bbb_context_get_song(struct bbb_context *context) {
   if (!context||!context->song) return 0;
-  return context->song->file;
+  return context->song->timeline->file;
 }
 
 int bbb_context_get_rate(const struct bbb_context *context) {
@@ -84,6 +169,11 @@ int bbb_context_get_rate(const struct bbb_context *context) {
   return context->rate;
 }
 
+int bbb_context_get_output_rate(const struct bbb_context *context) {
+  if (!context) return 0;
+  return context->outrate;
+}
+
 int bbb_context_get_chanc(const struct bbb_context *context) {
   if (!context) return 0;
   return context->chanc;
@@ -95,13 +185,16 @@ struct bbb_store *bbb_context_get_store(const struct bbb_context *context) {
 }
 
 /* Add printer.
+ * Store might give us the same printer more than once, if a sound repeats before it's done.
  */
  
-static int bbb_context_add_printer(struct bbb_context *context,struct bbb_printer *printer) {
+static int bbb_context_add_printer_locked(struct bbb_context *context,struct bbb_printer *printer) {
+  int i=context->printerc;
+  while (i-->0) if (context->printerv[i]==printer) return 0;
   if (context->printerc>=context->printera) {
     int na=context->printera+16;
     if (na>INT_MAX/sizeof(void*)) return -1;
-    void *nv=realloc(context->printerv,sizeof(void*)*na);
+    void *nv=bb_realloc(context->printerv,sizeof(void*)*na);
     if (!nv) return -1;
     context->printerv=nv;
     context->printera=na;
@@ -111,10 +204,22 @@ static int bbb_context_add_printer(struct bbb_context *context,struct bbb_printe
   return 0;
 }
 
+static int bbb_context_add_printer(struct bbb_context *context,struct bbb_printer *printer) {
+  pthread_mutex_lock(&context->idlemtx);
+  int err=bbb_context_add_printer_locked(context,printer);
+  pthread_mutex_unlock(&context->idlemtx);
+  return err;
+}
+
 /* Add voice.
  */
  
-static struct bbb_voice *bbb_context_add_voice(struct bbb_context *context,int voiceid,struct bbb_pcm *pcm) {
+static struct bbb_voice *bbb_context_add_voice(
+  struct bbb_context *context,
+  int voiceid,
+  struct bbb_pcm *pcm,
+  struct bbb_printer *printer
+) {
   
   struct bbb_voice *voice=0;
   if (context->voicec<context->voicea) {
@@ -132,7 +237,7 @@ static struct bbb_voice *bbb_context_add_voice(struct bbb_context *context,int v
       if (context->voicea>=context->voice_limit) return 0;
       int na=context->voicea+8;
       if (na>INT_MAX/sizeof(struct bbb_voice)) return 0;
-      void *nv=realloc(context->voicev,sizeof(struct bbb_voice)*na);
+      void *nv=bb_realloc(context->voicev,sizeof(struct bbb_voice)*na);
       if (!nv) return 0;
       context->voicev=nv;
       context->voicea=na;
@@ -140,39 +245,90 @@ static struct bbb_voice *bbb_context_add_voice(struct bbb_context *context,int v
     }
   }
   
-  if (bbb_voice_setup(voice,voiceid,pcm)<0) return 0;
+  // Every voice on a pcm in progress gets its printer, so it never stalls waiting for someone else to print.
+  struct bbb_printer *shared=0;
+  if (pcm->inprogress&&(!printer||(printer->pcm!=pcm))) {
+    if ((shared=bbb_store_get_printer(context->store,pcm))&&(bbb_context_add_printer(context,shared)>=0)) {
+      printer=shared;
+    }
+  }
+  
+  int err=bbb_voice_setup(voice,voiceid,pcm,printer);
+  bbb_printer_del(shared);
+  if (err<0) return 0;
   return voice;
 }
 
 /* Note On.
  */
  
+/* Which sound to play for a note, how fast, and how loud.
+ * Usually the note itself, at normal rate and unity gain.
+ * If the program reuses anchors, the nearest anchor, pitched to match.
+ * Both notes must be playable, so we never sound a note the program left out.
+ * If the program takes velocity as gain, we ask for full velocity and return the real one as gain.
+ */
+ 
+static uint32_t bbb_context_note_sndid(
+  uint32_t *rate,int *gain,
+  const struct bbb_context *context,
+  uint8_t pid,uint8_t noteid,uint8_t velocity
+) {
+  *rate=BBB_VOICE_RATE_NORMAL;
+  *gain=BBB_VOICE_GAIN_UNITY;
+  const struct bbb_store *store=context->store;
+  int route=store->routev[pid];
+  if (!route--) return 0;
+  if (store->velgainv[route]) {
+    *gain=((velocity&0x7f)+1)<<1;
+    velocity=0x7f;
+  }
+  int interval=store->reusev[route];
+  if ((interval>1)&&(noteid<0x80)) {
+    int anchor=((noteid+(interval>>1))/interval)*interval;
+    if (anchor>0x7f) anchor-=interval;
+    if ((anchor!=noteid)&&store->notev[route][anchor]&&store->notev[route][noteid]) {
+      uint32_t sndid=bbb_sndid(context,pid,anchor,velocity);
+      if (sndid) {
+        *rate=(bb_hz_from_noteidv[noteid]*65536.0)/bb_hz_from_noteidv[anchor];
+        return sndid;
+      }
+    }
+  }
+  return bbb_sndid(context,pid,noteid,velocity);
+}
+
 static int bbb_context_note_on(struct bbb_context *context,uint8_t chid,uint8_t noteid,uint8_t velocity) {
   
   uint8_t pid=(chid<BBB_CHANNEL_COUNT)?context->channelv[chid].pid:0;
-  uint32_t sndid=bbb_sndid(context,pid,noteid,velocity);
+  uint32_t rate;
+  int gain;
+  bbb_store_lock(context->store);
+  uint32_t sndid=bbb_context_note_sndid(&rate,&gain,context,pid,noteid,velocity);
+  bbb_store_unlock(context->store);
   if (!sndid) return 0;
   
   struct bbb_pcm *pcm=0;
   struct bbb_printer *printer=0;
   if (!(pcm=bbb_store_get_pcm(&printer,context->store,sndid))) return 0;
   
-  if (printer) {
-    int err=bbb_context_add_printer(context,printer);
+  if (printer&&(bbb_context_add_printer(context,printer)<0)) {
     bbb_printer_del(printer);
-    if (err<0) {
-      bbb_pcm_del(pcm);
-      return -1;
-    }
+    bbb_pcm_del(pcm);
+    return -1;
   }
   
   int voiceid=context->voiceid_next++;
-  struct bbb_voice *voice=bbb_context_add_voice(context,voiceid,pcm);
+  struct bbb_voice *voice=bbb_context_add_voice(context,voiceid,pcm,printer);
   bbb_pcm_del(pcm);
+  bbb_printer_del(printer);
   if (!voice) return -1;
   
   voice->chid=chid;
   voice->noteid=noteid;
+  voice->rate=rate;
+  voice->gain=gain;
+  voice->level=gain;
   
   return voiceid;
 }
@@ -180,24 +336,21 @@ static int bbb_context_note_on(struct bbb_context *context,uint8_t chid,uint8_t
 /* New voice by sndid.
  */
 
-int bbb_context_voice_on_sndid(struct bbb_context *context,uint32_t sndid,int sustain) {
+static int bbb_context_voice_on_sndid_inner(struct bbb_context *context,uint32_t sndid,int sustain) {
   
   struct bbb_pcm *pcm=0;
   struct bbb_printer *printer=0;
   if (!(pcm=bbb_store_get_pcm(&printer,context->store,sndid))) return 0;
   
-  if (printer) {
-    int err=bbb_context_add_printer(context,printer);
+  if (printer&&(bbb_context_add_printer(context,printer)<0)) {
     bbb_printer_del(printer);
-    if (err<0) {
-      bbb_pcm_del(pcm);
-      return -1;
-    }
+    bbb_pcm_del(pcm);
+    return -1;
   }
   
   int voiceid=0;
   if (sustain) voiceid=context->voiceid_next++;
-  struct bbb_voice *voice=bbb_context_add_voice(context,voiceid,pcm);
+  struct bbb_voice *voice=bbb_context_add_voice(context,voiceid,pcm,printer);
   bbb_pcm_del(pcm);
   bbb_printer_del(printer);
   if (!voice) return -1;
@@ -205,19 +358,166 @@ int bbb_context_voice_on_sndid(struct bbb_context *context,uint32_t sndid,int su
   return voiceid;
 }
 
+int bbb_context_voice_on_sndid(struct bbb_context *context,uint32_t sndid,int sustain) {
+  struct bb_allocator *pvallocator=bbb_context_enter(context);
+  int err=bbb_context_voice_on_sndid_inner(context,sndid,sustain);
+  bbb_context_leave(context,pvallocator);
+  return err;
+}
+
+/* Grow voice and printer lists ahead of a batch, so we reallocate at most once each.
+ * Voices are capped at (voice_limit) as usual, we don't fail if there isn't room for all.
+ */
+ 
+static int bbb_context_reserve(struct bbb_context *context,int voicec,int printerc) {
+  if (voicec>INT_MAX-context->voicec) return -1;
+  int na=context->voicec+voicec;
+  if (na>context->voice_limit) na=context->voice_limit;
+  if (na>context->voicea) {
+    if (na>INT_MAX/sizeof(struct bbb_voice)) return -1;
+    void *nv=bb_realloc(context->voicev,sizeof(struct bbb_voice)*na);
+    if (!nv) return -1;
+    context->voicev=nv;
+    context->voicea=na;
+  }
+  pthread_mutex_lock(&context->idlemtx);
+  int err=0;
+  if (printerc>INT_MAX-context->printerc) err=-1;
+  else if ((na=context->printerc+printerc)>context->printera) {
+    void *nv=0;
+    if ((na>INT_MAX/sizeof(void*))||!(nv=bb_realloc(context->printerv,sizeof(void*)*na))) err=-1;
+    else {
+      context->printerv=nv;
+      context->printera=na;
+    }
+  }
+  pthread_mutex_unlock(&context->idlemtx);
+  return err;
+}
+
+/* New voices by sndid, in bulk.
+ */
+ 
+struct bbb_batch_sound {
+  uint32_t sndid;
+  struct bbb_pcm *pcm;
+  struct bbb_printer *printer;
+};
+
+static int bbb_batch_sound_cmp(const void *a,const void *b) {
+  const struct bbb_batch_sound *A=a,*B=b;
+  if (A->sndid<B->sndid) return -1;
+  if (A->sndid>B->sndid) return 1;
+  return 0;
+}
+
+static const struct bbb_batch_sound *bbb_batch_sound_search(const struct bbb_batch_sound *v,int c,uint32_t sndid) {
+  int lo=0,hi=c;
+  while (lo<hi) {
+    int ck=(lo+hi)>>1;
+         if (sndid<v[ck].sndid) hi=ck;
+    else if (sndid>v[ck].sndid) lo=ck+1;
+    else return v+ck;
+  }
+  return 0;
+}
+
+static int bbb_context_voice_on_batch_inner(struct bbb_context *context,const uint32_t *sndidv,int c,int *voiceidv) {
+  if (!context||(c<1)) return 0;
+  if (!sndidv) return -1;
+  if (voiceidv) memset(voiceidv,0,sizeof(int)*c);
+  
+  // Sort and deduplicate. A typical batch fits on the stack.
+  struct bbb_batch_sound stackv[32];
+  struct bbb_batch_sound *soundv=stackv;
+  if (c>sizeof(stackv)/sizeof(stackv[0])) {
+    if (c>INT_MAX/sizeof(struct bbb_batch_sound)) return -1;
+    if (!(soundv=bb_malloc(sizeof(struct bbb_batch_sound)*c))) return -1;
+  }
+  int soundc=0,i;
+  for (i=0;i<c;i++) {
+    if (!sndidv[i]) continue;
+    soundv[soundc].sndid=sndidv[i];
+    soundv[soundc].pcm=0;
+    soundv[soundc].printer=0;
+    soundc++;
+  }
+  qsort(soundv,soundc,sizeof(struct bbb_batch_sound),bbb_batch_sound_cmp);
+  int uniquec=0;
+  for (i=0;i<soundc;i++) {
+    if (uniquec&&(soundv[uniquec-1].sndid==soundv[i].sndid)) continue;
+    soundv[uniquec++]=soundv[i];
+  }
+  soundc=uniquec;
+  
+  // Room for everybody, at worst one printer per unique sound.
+  // Failing to reserve is not fatal, we just grow one at a time instead.
+  bbb_context_reserve(context,c,soundc);
+  
+  // One store probe per unique sound. Repeats share the pcm, and therefore its printer.
+  // A sound whose printer we can't keep is unplayable.
+  for (i=0;i<soundc;i++) {
+    struct bbb_batch_sound *sound=soundv+i;
+    if (!(sound->pcm=bbb_store_get_pcm(&sound->printer,context->store,sound->sndid))) continue;
+    if (sound->printer&&(bbb_context_add_printer(context,sound->printer)<0)) {
+      bbb_pcm_del(sound->pcm);
+      bbb_printer_del(sound->printer);
+      sound->pcm=0;
+      sound->printer=0;
+    }
+  }
+  
+  // One voice per request, in the caller's order.
+  // Past the voice limit, the rest are skipped like unplayable ones.
+  int startc=0;
+  for (i=0;i<c;i++) {
+    const struct bbb_batch_sound *sound=bbb_batch_sound_search(soundv,soundc,sndidv[i]);
+    if (!sound||!sound->pcm) continue;
+    int voiceid=voiceidv?context->voiceid_next:0;
+    struct bbb_voice *voice=bbb_context_add_voice(context,voiceid,sound->pcm,sound->printer);
+    if (!voice) continue;
+    if (voiceidv) {
+      context->voiceid_next++;
+      voiceidv[i]=voice->voiceid;
+    }
+    startc++;
+  }
+  
+  for (i=soundc;i-->0;) {
+    bbb_pcm_del(soundv[i].pcm);
+    bbb_printer_del(soundv[i].printer);
+  }
+  if (soundv!=stackv) bb_free(soundv);
+  return startc;
+}
+
+int bbb_context_voice_on_batch(struct bbb_context *context,const uint32_t *sndidv,int c,int *voiceidv) {
+  struct bb_allocator *pvallocator=bbb_context_enter(context);
+  int err=bbb_context_voice_on_batch_inner(context,sndidv,c,voiceidv);
+  bbb_context_leave(context,pvallocator);
+  return err;
+}
+
 /* New voice with pcm.
  */
  
-int bbb_context_voice_on(struct bbb_context *context,struct bbb_pcm *pcm,int sustain) {
+static int bbb_context_voice_on_inner(struct bbb_context *context,struct bbb_pcm *pcm,int sustain) {
   
   int voiceid=0;
   if (sustain) voiceid=context->voiceid_next++;
-  struct bbb_voice *voice=bbb_context_add_voice(context,voiceid,pcm);
+  struct bbb_voice *voice=bbb_context_add_voice(context,voiceid,pcm,0);
   if (!voice) return -1;
   
   return voiceid;
 }
 
+int bbb_context_voice_on(struct bbb_context *context,struct bbb_pcm *pcm,int sustain) {
+  struct bb_allocator *pvallocator=bbb_context_enter(context);
+  int err=bbb_context_voice_on_inner(context,pcm,sustain);
+  bbb_context_leave(context,pvallocator);
+  return err;
+}
+
 /* Release voice.
  */
  
@@ -251,23 +551,29 @@ void bbb_context_all_off(struct bbb_context *context) {
   struct bbb_voice *voice=context->voicev;
   int i=context->voicec;
   for (;i-->0;voice++) {
+    if (context->bounce&&(voice->pcm==context->bounce)) continue;
     voice->voiceid=0;
   }
 }
 
+// A bounced song is the song, not a voice, so it stays.
 void bbb_context_silence(struct bbb_context *context) {
   struct bbb_voice *voice=context->voicev;
-  int i=context->voicec;
+  int i=context->voicec,keepc=0;
   for (;i-->0;voice++) {
-    bbb_voice_cleanup(voice);
+    if (context->bounce&&(voice->pcm==context->bounce)) {
+      context->voicev[keepc++]=*voice;
+    } else {
+      bbb_voice_cleanup(voice);
+    }
   }
-  context->voicec=0;
+  context->voicec=keepc;
 }
 
 /* Process event.
  */
  
-int bbb_context_event(struct bbb_context *context,const struct bb_midi_event *event) {
+static int bbb_context_event_inner(struct bbb_context *context,const struct bb_midi_event *event) {
   
   //fprintf(stderr,"%s %02x %02x %02x %02x\n",__func__,event->opcode,event->chid,event->a,event->b);
   
@@ -305,22 +611,162 @@ int bbb_context_event(struct bbb_context *context,const struct bb_midi_event *ev
   return 0;
 }
 
+int bbb_context_event(struct bbb_context *context,const struct bb_midi_event *event) {
+  struct bb_allocator *pvallocator=bbb_context_enter(context);
+  int err=bbb_context_event_inner(context,event);
+  bbb_context_leave(context,pvallocator);
+  return err;
+}
+
 /* Update printers.
+ * Whoever takes a printer out of the list reports it finished, outside (idlemtx) since that takes the store's lock.
  */
  
+static struct bbb_printer *bbb_context_remove_printer_locked(struct bbb_context *context,int p) {
+  struct bbb_printer *printer=context->printerv[p];
+  context->printerc--;
+  memmove(context->printerv+p,context->printerv+p+1,sizeof(void*)*(context->printerc-p));
+  if (p<context->idlep) context->idlep--;
+  return printer;
+}
+
+static void bbb_context_finish_printer(struct bbb_context *context,struct bbb_printer *printer) {
+  bbb_store_print_finished(context->store,printer->pcm);
+  bbb_printer_del(printer);
+}
+
 static int bbb_context_update_printers(struct bbb_context *context,int framec) {
+  pthread_mutex_lock(&context->idlemtx);
   int i=context->printerc;
   while (i-->0) {
     struct bbb_printer *printer=context->printerv[i];
-    int err=bbb_printer_update(printer,framec);
+    if (bbb_printer_update(printer,framec)>0) continue;
+    bbb_context_remove_printer_locked(context,i);
+    pthread_mutex_unlock(&context->idlemtx);
+    bbb_context_finish_printer(context,printer);
+    pthread_mutex_lock(&context->idlemtx);
+    if (i>context->printerc) i=context->printerc; // Idle may have removed some meanwhile.
+  }
+  pthread_mutex_unlock(&context->idlemtx);
+  return 0;
+}
+
+/* Record the song's next few notes for bbb_context_idle(), at the end of each update.
+ * Idle can't read the song itself: It runs without the driver's lock, and update advances and deletes the song.
+ */
+ 
+static void bbb_context_publish_lookahead(struct bbb_context *context) {
+  struct bbb_ahead aheadv[BBB_IDLE_LOOKAHEAD];
+  int aheadc=0;
+  if (context->song&&!context->bounce) {
+    const struct bb_midi_timeline *timeline=context->song->timeline;
+    uint8_t pidv[BBB_CHANNEL_COUNT];
+    int chid=0;
+    for (;chid<BBB_CHANNEL_COUNT;chid++) pidv[chid]=context->channelv[chid].pid;
+    int p=context->song->p,i=BBB_IDLE_LOOKAHEAD;
+    for (;(i-->0)&&(p<timeline->eventc);p++) {
+      const struct bb_midi_event *event=&timeline->eventv[p].event;
+      if (event->chid>=BBB_CHANNEL_COUNT) continue;
+      if (event->opcode==BB_MIDI_OPCODE_PROGRAM) {
+        pidv[event->chid]=event->a;
+        continue;
+      }
+      if ((event->opcode!=BB_MIDI_OPCODE_NOTE_ON)||!event->b) continue;
+      struct bbb_ahead *ahead=aheadv+aheadc++;
+      ahead->pid=pidv[event->chid];
+      ahead->noteid=event->a;
+      ahead->velocity=event->b;
+    }
+  }
+  pthread_mutex_lock(&context->idlemtx);
+  memcpy(context->aheadv,aheadv,sizeof(struct bbb_ahead)*aheadc);
+  context->aheadc=aheadc;
+  pthread_mutex_unlock(&context->idlemtx);
+}
+
+/* Print ahead in spare time.
+ * First, start printing whatever the song's next few notes will need, so update() finds them already under way.
+ * Then go round-robin in small chunks, so every outstanding printer gets a fair share of the budget.
+ * The cursor persists across calls, and we check the clock after every chunk.
+ * Printing happens without any lock of ours, we only hold (idlemtx) to pick the next printer.
+ */
+ 
+#define BBB_IDLE_CHUNK 1024
+
+static void bbb_context_lookahead(struct bbb_context *context,int64_t deadline) {
+  struct bbb_ahead aheadv[BBB_IDLE_LOOKAHEAD];
+  pthread_mutex_lock(&context->idlemtx);
+  int aheadc=context->aheadc;
+  memcpy(aheadv,context->aheadv,sizeof(struct bbb_ahead)*aheadc);
+  pthread_mutex_unlock(&context->idlemtx);
+  if (!aheadc) return;
+  
+  // Lookahead requests are not real hits, keep them out of the usage profile.
+  // New printers wait until we let go of the store: Adding them takes (idlemtx).
+  struct bbb_store *store=context->store;
+  struct bbb_printer *printerv[BBB_IDLE_LOOKAHEAD];
+  int printerc=0,i=0;
+  bbb_store_lock(store);
+  int profile=store->profile;
+  store->profile=0;
+  for (;i<aheadc;i++) {
+    const struct bbb_ahead *ahead=aheadv+i;
+    uint32_t rate;
+    int gain;
+    uint32_t sndid=bbb_context_note_sndid(&rate,&gain,context,ahead->pid,ahead->noteid,ahead->velocity);
+    if (!sndid||(bbb_store_search(store,sndid)>=0)) continue;
+    struct bbb_printer *printer=0;
+    struct bbb_pcm *pcm=bbb_store_get_pcm(&printer,store,sndid);
+    if (printer) printerv[printerc++]=printer;
+    bbb_pcm_del(pcm);
+    if (bbb_store_now_us()>=deadline) break;
+  }
+  store->profile=profile;
+  bbb_store_unlock(store);
+  
+  for (i=0;i<printerc;i++) {
+    bbb_context_add_printer(context,printerv[i]);
+    bbb_printer_del(printerv[i]);
+  }
+}
+
+static int bbb_context_idle_inner(struct bbb_context *context,int max_us) {
+  if (!context) return -1;
+  int64_t deadline=bbb_store_now_us()+max_us;
+  if (max_us>0) bbb_context_lookahead(context,deadline);
+  pthread_mutex_lock(&context->idlemtx);
+  while ((max_us>0)&&(context->printerc>0)) {
+    if (context->idlep>=context->printerc) context->idlep=0;
+    struct bbb_printer *printer=context->printerv[context->idlep++];
+    if (bbb_printer_ref(printer)<0) break;
+    pthread_mutex_unlock(&context->idlemtx);
+    int err=bbb_printer_update(printer,BBB_IDLE_CHUNK);
+    pthread_mutex_lock(&context->idlemtx);
+    
+    // Finished? Take it out, unless update() got there first.
     if (err<=0) {
-      bbb_store_print_finished(context->store,printer->pcm);
-      context->printerc--;
-      memmove(context->printerv+i,context->printerv+i+1,sizeof(void*)*(context->printerc-i));
-      bbb_printer_del(printer);
+      int p=context->printerc;
+      while (p-->0) if (context->printerv[p]==printer) break;
+      if (p>=0) {
+        bbb_context_remove_printer_locked(context,p);
+        pthread_mutex_unlock(&context->idlemtx);
+        bbb_context_finish_printer(context,printer);
+        pthread_mutex_lock(&context->idlemtx);
+      }
     }
+    bbb_printer_del(printer);
+    if (bbb_store_now_us()>=deadline) break;
   }
-  return 0;
+  int printerc=context->printerc;
+  pthread_mutex_unlock(&context->idlemtx);
+  return printerc;
+}
+
+int bbb_context_idle(struct bbb_context *context,int max_us) {
+  struct bb_allocator *pvallocator=bbb_context_enter(context);
+  int err=bbb_context_idle_inner(context,max_us);
+  bbb_context_leave(context,pvallocator);
+  return err;
 }
 
 /* Update for mono output -- ideal case.
@@ -334,9 +780,9 @@ static void bbb_context_update_mono(int16_t *v,int c,struct bbb_context *context
     if (context->song) {
       while (1) {
         struct bb_midi_event event;
-        updc=bb_midi_file_reader_update(&event,context->song);
+        updc=bb_midi_timeline_reader_update(&event,context->song);
         if (updc<0) {
-          bb_midi_file_reader_del(context->song);
+          bb_midi_timeline_reader_del(context->song);
           context->song=0;
           updc=c;
           break;
@@ -344,7 +790,7 @@ static void bbb_context_update_mono(int16_t *v,int c,struct bbb_context *context
         if (updc) {
           break;
         }
-        bbb_context_event(context,&event);
+        if (!context->bounce) bbb_context_event(context,&event);
       }
       if (updc>c) updc=c;
     } else {
@@ -352,7 +798,7 @@ static void bbb_context_update_mono(int16_t *v,int c,struct bbb_context *context
     }
     if (updc<1) return; // oops
     if (context->song) {
-      bb_midi_file_reader_advance(context->song,updc);
+      bb_midi_timeline_reader_advance(context->song,updc);
     }
     
     // Now we have the update length, update printers.
@@ -370,6 +816,51 @@ static void bbb_context_update_mono(int16_t *v,int c,struct bbb_context *context
   }
 }
 
+/* Update at the internal rate into a private buffer, then resample to (c) frames at the output rate.
+ * Interpolates between consecutive internal samples, starting with what we carried over from the last update.
+ * We render through the right side of the last interpolation, and carry whatever that doesn't consume.
+ */
+ 
+static void bbb_context_update_resample(int16_t *v,int c,struct bbb_context *context) {
+  uint64_t step=context->rsstep;
+  uint64_t end=context->rsphase+step*c;
+  int consumec=(int)(end>>32);
+  int srcc=(int)((context->rsphase+step*(c-1))>>32)+2;
+  if (srcc<consumec+1) srcc=consumec+1;
+  if (srcc>context->rsa) {
+    void *nv=bb_realloc(context->rsv,sizeof(int16_t)*srcc);
+    if (!nv) return;
+    context->rsv=nv;
+    context->rsa=srcc;
+  }
+  int16_t *src=context->rsv;
+  memcpy(src,context->rscarryv,context->rscarryc<<1);
+  int newc=srcc-context->rscarryc;
+  if (newc>0) {
+    memset(src+context->rscarryc,0,newc<<1);
+    bbb_context_update_mono(src+context->rscarryc,newc,context);
+  }
+  
+  uint64_t p=context->rsphase;
+  for (;c-->0;v++,p+=step) {
+    const int16_t *a=src+(p>>32);
+    int32_t frac=(uint32_t)p>>17; // 15 bits, so a full-scale difference times this still fits in 32.
+    *v=a[0]+(((a[1]-a[0])*frac)>>15);
+  }
+  
+  context->rscarryc=srcc-consumec;
+  memcpy(context->rscarryv,src+consumec,context->rscarryc<<1);
+  context->rsphase=(uint32_t)end;
+}
+
+/* Mono at the output rate, whatever the internal rate.
+ */
+ 
+static void bbb_context_update_output(int16_t *v,int c,struct bbb_context *context) {
+  if (context->outrate==context->rate) bbb_context_update_mono(v,c,context);
+  else bbb_context_update_resample(v,c,context);
+}
+
 /* Update for multi-channel output.
  * Do a mono update into the same buffer, then expand it.
  */
@@ -377,7 +868,7 @@ static void bbb_context_update_mono(int16_t *v,int c,struct bbb_context *context
 static void bbb_context_update_multi(int16_t *v,int c,struct bbb_context *context) {
   if (c%context->chanc) return;
   int framec=c/context->chanc;
-  bbb_context_update_mono(v,framec,context);
+  bbb_context_update_output(v,framec,context);
   int16_t *dst=v+c;
   const int16_t *src=v+framec;
   if (context->chanc==2) { // 2 is way more likely than any other. Hard-code that case to facilitate optimization.
@@ -420,45 +911,335 @@ static void bbb_context_gc(struct bbb_context *context) {
 /* Update.
  */
 
-void bbb_context_update(int16_t *v,int c,struct bbb_context *context) {
+static void bbb_context_update_inner(int16_t *v,int c,struct bbb_context *context) {
   if (c<1) return;
   if (!v||!context) return;
   memset(v,0,c<<1);
-  if (context->chanc==1) bbb_context_update_mono(v,c,context);
+  if (context->chanc==1) bbb_context_update_output(v,c,context);
   else bbb_context_update_multi(v,c,context);
   bbb_context_gc(context);
 }
 
+void bbb_context_update(int16_t *v,int c,struct bbb_context *context) {
+  struct bb_allocator *pvallocator=bbb_context_enter(context);
+  bbb_context_update_inner(v,c,context);
+  if (context) bbb_context_publish_lookahead(context);
+  bbb_context_leave(context,pvallocator);
+}
+
+/* Bounced song.
+ * PCM is the first pass from time zero, then one more pass from the repeat point, which is the loop.
+ * That second pass starts with tails rung over from the first, as every later pass would.
+ */
+ 
+#define BBB_BOUNCE_CHUNK 4096
+
+static struct bbb_voice *bbb_context_get_bounce_voice(struct bbb_context *context) {
+  if (!context->bounce) return 0;
+  struct bbb_voice *voice=context->voicev;
+  int i=context->voicec;
+  for (;i-->0;voice++) {
+    if (voice->pcm==context->bounce) return voice;
+  }
+  return 0;
+}
+
+// Frame in the bounce corresponding to the song reader's current position.
+static int bbb_context_get_bounce_position(const struct bbb_context *context,int repeattime) {
+  const struct bb_midi_timeline_reader *reader=context->song;
+  if (!reader->passc) return reader->now;
+  return reader->timeline->endtime+reader->now-repeattime;
+}
+
+/* Drop the bounce voice cold and resume playing events.
+ * Anything that should be sounding from before now won't be; it's the same as a seek.
+ */
+static void bbb_context_end_bounce(struct bbb_context *context) {
+  if (!context->bounce) return;
+  struct bbb_voice *voice=bbb_context_get_bounce_voice(context);
+  if (voice) {
+    bbb_voice_cleanup(voice);
+    memset(voice,0,sizeof(struct bbb_voice));
+  }
+  bbb_pcm_del(context->bounce);
+  context->bounce=0;
+  if (context->song) {
+    uint8_t programv[16];
+    int mask=bb_midi_timeline_get_programs(programv,context->song->timeline,context->song->p);
+    if (mask>0) {
+      int chid=0;
+      for (;chid<BBB_CHANNEL_COUNT;chid++) {
+        if (mask&(1<<chid)) context->channelv[chid].pid=programv[chid];
+      }
+    }
+  }
+}
+
+// Division and an MD5 of each track, hashed again. Same song from any source gets the same digest.
+static int bbb_song_digest(uint8_t *dst,const struct bb_midi_file *file) {
+  int srcc=2+file->trackc*16;
+  uint8_t *src=bb_malloc(srcc);
+  if (!src) return -1;
+  src[0]=file->division>>8;
+  src[1]=file->division;
+  int i=0;
+  for (;i<file->trackc;i++) {
+    if (bb_md5(src+2+i*16,16,file->trackv[i].v,file->trackv[i].c)!=16) {
+      bb_free(src);
+      return -1;
+    }
+  }
+  int err=bb_md5(dst,16,src,srcc);
+  bb_free(src);
+  return (err==16)?0:-1;
+}
+
+/* Render in a private context: Mono, same rate, nothing else playing.
+ * It borrows our store, so it sees every program option we do and only prints what isn't resident yet.
+ * Printers still running at the end come over to us; they belong to the store's entries now.
+ */
+static struct bbb_pcm *bbb_context_render_bounce(struct bbb_context *context,struct bb_midi_file *file,int c,int loopa) {
+  struct bbb_context *offline=bbb_context_new_bare(context->rate,context->rate,1);
+  if (!offline) return 0;
+  if (bbb_store_ref(context->store)<0) {
+    bbb_context_del(offline);
+    return 0;
+  }
+  offline->store=context->store;
+  if (bbb_context_play_song(offline,file,1)<0) {
+    bbb_context_del(offline);
+    return 0;
+  }
+  struct bbb_pcm *pcm=bbb_pcm_new(c);
+  if (!pcm) {
+    bbb_context_del(offline);
+    return 0;
+  }
+  int p=0;
+  while (p<c) {
+    int updc=c-p;
+    if (updc>BBB_BOUNCE_CHUNK) updc=BBB_BOUNCE_CHUNK;
+    bbb_context_update(pcm->v+p,updc,offline);
+    p+=updc;
+  }
+  int i=offline->printerc;
+  while (i-->0) bbb_context_add_printer(context,offline->printerv[i]);
+  bbb_context_del(offline);
+  pcm->loopa=loopa;
+  pcm->loopz=c;
+  return pcm;
+}
+
+static int bbb_context_bounce_song_inner(struct bbb_context *context) {
+  if (!context||!context->song) return -1;
+  if (context->bounce) return 0;
+  struct bb_midi_timeline_reader *reader=context->song;
+  const struct bb_midi_timeline *timeline=reader->timeline;
+  if (!reader->repeat) return -1;
+  if (reader->tempo!=BB_MIDI_TEMPO_NORMAL) return -1;
+  int repeattime;
+  if (bb_midi_timeline_get_repeat_time(&repeattime,timeline)<0) return -1;
+  
+  // Total length is the first pass plus one more, and must fit in the store's budget.
+  int passlen=timeline->endtime-repeattime;
+  if (passlen<1) return -1;
+  bbb_store_lock(context->store);
+  int limit=context->store->limit_pcmt;
+  bbb_store_unlock(context->store);
+  if (timeline->endtime>limit-passlen) return -1;
+  int c=timeline->endtime+passlen;
+  
+  // Check the disk cache, or render it.
+  uint8_t songdigest[16];
+  if (bbb_song_digest(songdigest,timeline->file)<0) return -1;
+  struct bbb_pcm *pcm=bbb_store_get_bounce(context->store,songdigest);
+  if (pcm&&((pcm->c!=c)||(pcm->loopa!=timeline->endtime))) {
+    bbb_pcm_del(pcm);
+    pcm=0;
+  }
+  if (!pcm) {
+    if (!(pcm=bbb_context_render_bounce(context,timeline->file,c,timeline->endtime))) return -1;
+    bbb_store_set_bounce(context->store,songdigest,pcm);
+  }
+  
+  // Song voices stop cold; the bounce has them too.
+  struct bbb_voice *voice=context->voicev;
+  int i=context->voicec;
+  for (;i-->0;voice++) {
+    if (voice->chid==0xff) continue;
+    bbb_voice_cleanup(voice);
+    memset(voice,0,sizeof(struct bbb_voice));
+  }
+  
+  // Bounce goes on as one sustaining voice, picking up where the song is now.
+  if (!(voice=bbb_context_add_voice(context,context->voiceid_next++,pcm,0))) {
+    bbb_pcm_del(pcm);
+    return -1;
+  }
+  voice->p=bbb_context_get_bounce_position(context,repeattime);
+  context->bounce=pcm;
+  return 0;
+}
+
+int bbb_context_bounce_song(struct bbb_context *context) {
+  struct bb_allocator *pvallocator=bbb_context_enter(context);
+  int err=bbb_context_bounce_song_inner(context);
+  bbb_context_leave(context,pvallocator);
+  return err;
+}
+
 /* Begin song.
  */
 
-int bbb_context_play_song(struct bbb_context *context,struct bb_midi_file *file,int repeat) {
+static int bbb_context_play_song_inner(struct bbb_context *context,struct bb_midi_file *file,int repeat) {
 
   // Do nothing if we're already playing it.
   // There is no "force" option; caller can stop and restart if desired.
-  if (file&&context->song&&(file==context->song->file)) return 0;
+  if (file&&context->song&&(file==context->song->timeline->file)) return 0;
+  
+  bbb_context_end_bounce(context);
   
   // Null to end song.
   if (!file) {
-    bb_midi_file_reader_del(context->song);
+    bb_midi_timeline_reader_del(context->song);
     context->song=0;
     return 0;
   }
   
   // Stop what's playing now.
   if (context->song) {
-    bb_midi_file_reader_del(context->song);
+    bb_midi_timeline_reader_del(context->song);
     context->song=0;
     bbb_context_all_song_notes_off(context);
   }
   
-  // Create a new file reader for it.
-  if (!(context->song=bb_midi_file_reader_new(file,context->rate))) return -1;
+  // Flatten it into a timeline at our rate, and start reading.
+  struct bb_midi_timeline *timeline=bb_midi_timeline_new(file,context->rate);
+  if (!timeline) return -1;
+  context->song=bb_midi_timeline_reader_new(timeline);
+  bb_midi_timeline_del(timeline);
+  if (!context->song) return -1;
   context->song->repeat=repeat;
+  bb_midi_timeline_reader_set_tempo(context->song,context->tempo);
 
   return 0;
 }
 
+int bbb_context_play_song(struct bbb_context *context,struct bb_midi_file *file,int repeat) {
+  struct bb_allocator *pvallocator=bbb_context_enter(context);
+  int err=bbb_context_play_song_inner(context,file,repeat);
+  if (context) bbb_context_publish_lookahead(context);
+  bbb_context_leave(context,pvallocator);
+  return err;
+}
+
+/* Seek in song.
+ */
+ 
+int bbb_context_seek_song(struct bbb_context *context,int frame) {
+  if (!context||!context->song) return -1;
+  if (bb_midi_timeline_reader_seek(context->song,frame)<0) return -1;
+  if (context->bounce) {
+    struct bbb_voice *voice=bbb_context_get_bounce_voice(context);
+    if (voice) voice->p=context->song->now;
+    return 0;
+  }
+  bbb_context_all_song_notes_off(context);
+  // Channels the song hasn't programmed yet keep whatever the host gave them.
+  uint8_t programv[16];
+  int mask=bb_midi_timeline_get_programs(programv,context->song->timeline,context->song->p);
+  if (mask<0) return -1;
+  int chid=0;
+  for (;chid<BBB_CHANNEL_COUNT;chid++) {
+    if (mask&(1<<chid)) context->channelv[chid].pid=programv[chid];
+  }
+  bbb_context_publish_lookahead(context);
+  return 0;
+}
+
+int bbb_context_get_song_position(const struct bbb_context *context) {
+  if (!context||!context->song) return -1;
+  return context->song->now;
+}
+
+/* Tempo.
+ */
+ 
+int bbb_context_set_tempo(struct bbb_context *context,int tempo) {
+  if (!context) return -1;
+  if (tempo<BB_MIDI_TEMPO_MIN) tempo=BB_MIDI_TEMPO_MIN;
+  else if (tempo>BB_MIDI_TEMPO_MAX) tempo=BB_MIDI_TEMPO_MAX;
+  context->tempo=tempo;
+  if (tempo!=BB_MIDI_TEMPO_NORMAL) bbb_context_end_bounce(context);
+  if (context->song) bb_midi_timeline_reader_set_tempo(context->song,tempo);
+  return tempo;
+}
+
+int bbb_context_get_tempo(const struct bbb_context *context) {
+  if (!context) return 0;
+  return context->tempo;
+}
+
+int bbb_context_get_song_usperqnote(const struct bbb_context *context) {
+  if (!context||!context->song) return 0;
+  int usperqnote=bb_midi_timeline_get_usperqnote(context->song->timeline,context->song->p);
+  return ((int64_t)usperqnote<<16)/context->tempo;
+}
+
+/* Reload archive.
+ */
+ 
+int bbb_context_reload_archive(struct bbb_context *context,const char *path) {
+  if (!context) return -1;
+  struct bb_allocator *pvallocator=bbb_context_enter(context);
+  int changec=bbb_store_reload(context->store,path);
+  if (changec>0) bbb_context_end_bounce(context);
+  bbb_context_leave(context,pvallocator);
+  return changec;
+}
+
+/* Per-program playback options.
+ */
+ 
+int bbb_context_set_program_reuse(struct bbb_context *context,uint8_t pid,int interval) {
+  if (!context) return -1;
+  if ((interval<0)||(interval>12)) return -1;
+  struct bbb_store *store=context->store;
+  bbb_store_lock(store);
+  int route=store->routev[pid];
+  if (route--) store->reusev[route]=interval;
+  bbb_store_unlock(store);
+  return (route<0)?-1:0;
+}
+
+int bbb_context_set_program_velocity_gain(struct bbb_context *context,uint8_t pid,int enable) {
+  if (!context) return -1;
+  struct bbb_store *store=context->store;
+  bbb_store_lock(store);
+  int route=store->routev[pid];
+  if (route--) store->velgainv[route]=enable?1:0;
+  bbb_store_unlock(store);
+  return (route<0)?-1:0;
+}
+
+/* Voice gain.
+ */
+ 
+int bbb_context_set_voice_gain(struct bbb_context *context,int voiceid,int gain) {
+  if (!context||(voiceid<1)) return -1;
+  if (gain<0) gain=0;
+  else if (gain>BBB_VOICE_GAIN_MAX) gain=BBB_VOICE_GAIN_MAX;
+  struct bbb_voice *voice=context->voicev;
+  int i=context->voicec;
+  for (;i-->0;voice++) {
+    if (voice->voiceid==voiceid) {
+      voice->gain=gain;
+      return 0;
+    }
+  }
+  return -1;
+}
+
 /* Pack sndid.
  */
  
@@ -467,15 +1248,12 @@ uint32_t bbb_sndid(const struct bbb_context *context,uint8_t pid,uint8_t noteid,
   // No context, give the generic response.
   if (!context) return (pid<<16)|(noteid<<8)|velocity;
   
-  // First, try to make pid valid.
-  struct bbb_program **pv=context->store->programv;
-       if (pv[pid]) ; // as requested
-  else if (pv[pid&~0x07]) pid&=~0x07; // start of row 
-  else if (pv[pid&~0x7f]) pid&=~0x7f; // start of bank
-  // We don't default to zero at the end: 0x80..0xff are presumed to be drums and foley (silence better than a tonal default).
-  struct bbb_program *program=pv[pid];
-  if (!program) return 0;
-  
-  // Program takes it from here.
-  return bbb_program_pack_sndid(program,pid,noteid,velocity);
+  // Store has already resolved the pid and asked the program about each note.
+  struct bbb_store *store=context->store;
+  bbb_store_lock(store);
+  int route=store->routev[pid];
+  uint16_t note=route?store->notev[route-1][noteid]:0;
+  bbb_store_unlock(store);
+  if (!note) return 0;
+  return ((route-1)<<16)|(noteid<<8)|(velocity&note);
 }
@@ -1,4 +1,5 @@
 #include "bbb/bbb.h"
+#include "share/bb_alloc.h"
 #include <stdlib.h>
 #include <limits.h>
 
@@ -7,12 +8,14 @@
  
 void bbb_pcm_del(struct bbb_pcm *pcm) {
   if (!pcm) return;
+  if (pcm->refc==BBB_PCM_REFC_STATIC) return;
   if (pcm->refc-->1) return;
-  free(pcm);
+  bb_free(pcm);
 }
  
 int bbb_pcm_ref(struct bbb_pcm *pcm) {
   if (!pcm) return -1;
+  if (pcm->refc==BBB_PCM_REFC_STATIC) return 0;
   if (pcm->refc<1) return -1;
   if (pcm->refc==INT_MAX) return -1;
   pcm->refc++;
@@ -22,11 +25,12 @@ int bbb_pcm_ref(struct bbb_pcm *pcm) {
 struct bbb_pcm *bbb_pcm_new(int c) {
   if (c<1) return 0;
   if ((int)sizeof(struct bbb_pcm)>INT_MAX-sizeof(int16_t)*c) return 0;
-  struct bbb_pcm *pcm=calloc(1,sizeof(struct bbb_pcm)+sizeof(int16_t)*c);
+  struct bbb_pcm *pcm=bb_calloc(1,sizeof(struct bbb_pcm)+sizeof(int16_t)*c);
   if (!pcm) return 0;
   
   pcm->refc=1;
   pcm->c=c;
+  pcm->readyc=c;
   
   return pcm;
 }
@@ -37,7 +41,7 @@ struct bbb_pcm *bbb_pcm_new(int c) {
 void bbb_wave_del(struct bbb_wave *wave) {
   if (!wave) return;
   if (wave->refc-->1) return;
-  free(wave);
+  bb_free(wave);
 }
 
 int bbb_wave_ref(struct bbb_wave *wave) {
@@ -49,7 +53,7 @@ int bbb_wave_ref(struct bbb_wave *wave) {
 }
 
 struct bbb_wave *bbb_wave_new() {
-  struct bbb_wave *wave=calloc(1,sizeof(struct bbb_wave));
+  struct bbb_wave *wave=bb_calloc(1,sizeof(struct bbb_wave));
   if (!wave) return 0;
   wave->refc=1;
   return wave;
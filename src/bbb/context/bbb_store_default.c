@@ -1,4 +1,5 @@
 #include "bbb_context_internal.h"
+#include "share/bb_serial.h"
 
 /* Hard-coded default programs.
  * Same basic idea as the Archive format: One-byte pid followed by self-terminated program.
@@ -78,6 +79,14 @@ static const uint8_t bbb_default_programs[]={
     0xe0,0xa8,0x64, // level
 };
 
+/* Digest of the table above, standing in for an archive digest.
+ * Cached sounds and bounces made with one build's defaults don't match another's.
+ */
+ 
+void bbb_store_get_default_digest(uint8_t *dst) {
+  if (bb_md5(dst,16,bbb_default_programs,sizeof(bbb_default_programs))!=16) memset(dst,0,16);
+}
+
 /* Load default programs, main entry point.
  */
  
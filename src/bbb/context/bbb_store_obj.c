@@ -1,6 +1,7 @@
 #include "bbb_context_internal.h"
 #include "share/bb_fs.h"
 #include "share/bb_codec.h"
+#include "share/bb_serial.h"
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -12,36 +13,52 @@
 
 static int bbb_store_get_cache_path(char *dst,int dsta,struct bbb_store *store,uint32_t sndid);
 static struct bbb_pcm *bbb_store_read_cache_file(struct bbb_store *store,const char *path);
+static struct bbb_pcm *bbb_store_trim(struct bbb_store *store,struct bbb_pcm *pcm);
+static struct bbb_pcm *bbb_store_dedup(struct bbb_store *store,struct bbb_pcm *pcm);
+static struct bbb_store_entry *bbb_store_uncount(struct bbb_store *store,struct bbb_store_entry *entry);
+static struct bbb_pcm *bbb_store_publish(struct bbb_store *store,uint32_t sndid,const struct bbb_pcm *pcm);
+static int bbb_store_print_finished_unlocked(struct bbb_store *store,struct bbb_pcm *pcm);
 
 /* Cleanup.
  */
  
 static void bbb_store_entry_cleanup(struct bbb_store_entry *entry) {
   bbb_pcm_del(entry->pcm);
+  bbb_printer_del(entry->printer);
 }
  
 void bbb_store_del(struct bbb_store *store) {
   if (!store) return;
   if (store->refc-->1) return;
   
-  if (store->configpath) free(store->configpath);
-  if (store->cachepath) free(store->cachepath);
+  if (store->configpath) bb_free(store->configpath);
+  if (store->cachepath) bb_free(store->cachepath);
+  bbb_archive_del(store->archive);
   
   bbb_wave_del(store->wave_sine);
   bbb_wave_del(store->wave_losquare);
   bbb_wave_del(store->wave_losaw);
   
   int i=256;
-  while (i-->0) bbb_program_del(store->programv[i]);
+  while (i-->0) {
+    bbb_program_del(store->programv[i]);
+    if (store->notev[i]) bb_free(store->notev[i]);
+  }
   
   if (store->entryv) {
     while (store->entryc-->0) {
       bbb_store_entry_cleanup(store->entryv+store->entryc);
     }
-    free(store->entryv);
+    bb_free(store->entryv);
   }
+  if (store->hashv) bb_free(store->hashv);
+  
+  if (store->profilev) bb_free(store->profilev);
+  if (store->sndpriorityv) bb_free(store->sndpriorityv);
+  bbb_shm_del(store->shm);
+  if (store->mtxok) pthread_mutex_destroy(&store->mtx);
   
-  free(store);
+  bb_free(store);
 }
 
 /* Retain.
@@ -59,12 +76,27 @@ int bbb_store_ref(struct bbb_store *store) {
  */
  
 struct bbb_store *bbb_store_new(struct bbb_context *context,const char *configpath,const char *cachepath) {
-  struct bbb_store *store=calloc(1,sizeof(struct bbb_store));
+  struct bbb_store *store=bb_calloc(1,sizeof(struct bbb_store));
   if (!store) return 0;
   
   store->context=context;
   store->refc=1;
   
+  // Recursive, so public entry points can lock without worrying about who calls whom.
+  pthread_mutexattr_t mtxattr;
+  if (pthread_mutexattr_init(&mtxattr)) {
+    bbb_store_del(store);
+    return 0;
+  }
+  pthread_mutexattr_settype(&mtxattr,PTHREAD_MUTEX_RECURSIVE);
+  if (pthread_mutex_init(&store->mtx,&mtxattr)) {
+    pthread_mutexattr_destroy(&mtxattr);
+    bbb_store_del(store);
+    return 0;
+  }
+  pthread_mutexattr_destroy(&mtxattr);
+  store->mtxok=1;
+  
   store->limit_pcmc=10000; // Very high; I doubt that we want to limit on count of entries.
   store->limit_pcmt=10<<20; // Total sample count. This is the bulk of BBA's memory usage, a useful limit.
   store->target_pcmc=store->limit_pcmc>>1;
@@ -72,7 +104,7 @@ struct bbb_store *bbb_store_new(struct bbb_context *context,const char *configpa
   
   if (configpath&&configpath[0]) {
     int c=1; while (configpath[c]) c++;
-    if (!(store->configpath=malloc(c+1))) {
+    if (!(store->configpath=bb_malloc(c+1))) {
       bbb_store_del(store);
       return 0;
     }
@@ -84,7 +116,7 @@ struct bbb_store *bbb_store_new(struct bbb_context *context,const char *configpa
   if (cachepath&&cachepath[0]) {
     int c=1; while (cachepath[c]) c++;
     while ((c>1)&&(cachepath[c-1]=='/')) c--; // Must not have a trailing slash
-    if (!(store->cachepath=malloc(c+1))) {
+    if (!(store->cachepath=bb_malloc(c+1))) {
       bbb_store_del(store);
       return 0;
     }
@@ -97,40 +129,207 @@ struct bbb_store *bbb_store_new(struct bbb_context *context,const char *configpa
 }
 
 /* Trivial accessors.
+ * Contexts sharing the store change these from other threads, so even reads take the lock.
  */
  
 int bbb_store_get_pcm_count(const struct bbb_store *store) {
-  return store?store->entryc:0;
+  if (!store) return 0;
+  bbb_store_lock((struct bbb_store*)store);
+  int pcmc=store->entryc;
+  bbb_store_unlock((struct bbb_store*)store);
+  return pcmc;
 }
- 
+
 int bbb_store_get_print_count(const struct bbb_store *store) {
-  return store?store->printc:0;
+  if (!store) return 0;
+  bbb_store_lock((struct bbb_store*)store);
+  int printc=store->printc;
+  bbb_store_unlock((struct bbb_store*)store);
+  return printc;
 }
 
 int bbb_store_get_eviction_count(const struct bbb_store *store) {
-  return store?store->evictionc:0;
+  if (!store) return 0;
+  bbb_store_lock((struct bbb_store*)store);
+  int evictionc=store->evictionc;
+  bbb_store_unlock((struct bbb_store*)store);
+  return evictionc;
 }
 
 int bbb_store_get_memory_estimate(const struct bbb_store *store) {
-  return store?(store->pcmtotal<<1):0;
+  if (!store) return 0;
+  bbb_store_lock((struct bbb_store*)store);
+  int bytec=store->pcmtotal<<1;
+  bbb_store_unlock((struct bbb_store*)store);
+  return bytec;
+}
+
+int bbb_store_get_dedup_savings(const struct bbb_store *store) {
+  if (!store) return 0;
+  bbb_store_lock((struct bbb_store*)store);
+  int bytec=store->dedupt<<1;
+  bbb_store_unlock((struct bbb_store*)store);
+  return bytec;
+}
+
+int bbb_store_set_dedup(struct bbb_store *store,int enable) {
+  if (!store) return -1;
+  bbb_store_lock(store);
+  store->dedup=enable?1:0;
+  bbb_store_unlock(store);
+  return 0;
+}
+
+int bbb_store_set_trim_threshold(struct bbb_store *store,int level) {
+  if (!store) return -1;
+  if (level<0) level=-1;
+  else if (level>0x7fff) level=0x7fff;
+  bbb_store_lock(store);
+  store->trim=level;
+  bbb_store_unlock(store);
+  return level;
+}
+
+/* Priority.
+ */
+ 
+static int bbb_store_sndpriority_search(const struct bbb_store *store,uint32_t sndid) {
+  int lo=0,hi=store->sndpriorityc;
+  while (lo<hi) {
+    int ck=(lo+hi)>>1;
+         if (sndid<store->sndpriorityv[ck].sndid) hi=ck;
+    else if (sndid>store->sndpriorityv[ck].sndid) lo=ck+1;
+    else return ck;
+  }
+  return -lo-1;
+}
+
+static uint8_t bbb_store_priority_for_sndid(const struct bbb_store *store,uint32_t sndid) {
+  uint8_t priority=store->priorityv[(sndid>>16)&0xff];
+  int p=bbb_store_sndpriority_search(store,sndid);
+  if ((p>=0)&&(store->sndpriorityv[p].priority>priority)) priority=store->sndpriorityv[p].priority;
+  return priority;
+}
+
+static void bbb_store_refresh_priority(struct bbb_store *store) {
+  struct bbb_store_entry *entry=store->entryv;
+  int i=store->entryc;
+  for (;i-->0;entry++) entry->priority=bbb_store_priority_for_sndid(store,entry->sndid);
+}
+
+static int bbb_store_set_sound_priority_unlocked(struct bbb_store *store,uint32_t sndid,uint8_t priority) {
+  if (!store) return -1;
+  if (!sndid||(sndid&0xff000000)) return -1;
+  int p=bbb_store_sndpriority_search(store,sndid);
+  if (p>=0) {
+    if (priority) {
+      store->sndpriorityv[p].priority=priority;
+    } else {
+      store->sndpriorityc--;
+      memmove(store->sndpriorityv+p,store->sndpriorityv+p+1,sizeof(struct bbb_store_priority)*(store->sndpriorityc-p));
+    }
+  } else if (priority) {
+    p=-p-1;
+    if (store->sndpriorityc>=store->sndprioritya) {
+      int na=store->sndprioritya+32;
+      if (na>INT_MAX/sizeof(struct bbb_store_priority)) return -1;
+      void *nv=bb_realloc(store->sndpriorityv,sizeof(struct bbb_store_priority)*na);
+      if (!nv) return -1;
+      store->sndpriorityv=nv;
+      store->sndprioritya=na;
+    }
+    struct bbb_store_priority *sndpriority=store->sndpriorityv+p;
+    memmove(sndpriority+1,sndpriority,sizeof(struct bbb_store_priority)*(store->sndpriorityc-p));
+    store->sndpriorityc++;
+    sndpriority->sndid=sndid;
+    sndpriority->priority=priority;
+  }
+  if ((p=bbb_store_search(store,sndid))>=0) {
+    store->entryv[p].priority=bbb_store_priority_for_sndid(store,sndid);
+  }
+  return 0;
+}
+
+int bbb_store_set_sound_priority(struct bbb_store *store,uint32_t sndid,uint8_t priority) {
+  if (!store) return -1;
+  bbb_store_lock(store);
+  int err=bbb_store_set_sound_priority_unlocked(store,sndid,priority);
+  bbb_store_unlock(store);
+  return err;
+}
+
+static int bbb_store_set_program_priority_unlocked(struct bbb_store *store,uint8_t pid,uint8_t priority) {
+  if (!store) return -1;
+  int route=store->routev[pid];
+  if (!route--) return -1;
+  store->priorityv[route]=priority;
+  bbb_store_refresh_priority(store);
+  return 0;
+}
+
+int bbb_store_set_program_priority(struct bbb_store *store,uint8_t pid,uint8_t priority) {
+  if (!store) return -1;
+  bbb_store_lock(store);
+  int err=bbb_store_set_program_priority_unlocked(store,pid,priority);
+  bbb_store_unlock(store);
+  return err;
+}
+
+/* Samples a pcm adds to (pcmtotal).
+ * Shared-memory pcms live in the segment, not our heap, so they don't count against our limits.
+ */
+ 
+static inline int bbb_store_pcm_weight(const struct bbb_pcm *pcm) {
+  return (pcm->refc==BBB_PCM_REFC_STATIC)?0:pcm->c;
+}
+
+/* Pinned entries' size and count.
+ * Duplicates are counted where their original is, so a pinned dup of an unpinned original doesn't count.
+ */
+ 
+static int bbb_store_count_pinned(int *pcmc,const struct bbb_store *store) {
+  int pcmt=0;
+  if (pcmc) *pcmc=0;
+  const struct bbb_store_entry *entry=store->entryv;
+  int i=store->entryc;
+  for (;i-->0;entry++) {
+    if (entry->priority!=BBB_PRIORITY_PINNED) continue;
+    if (pcmc) (*pcmc)++;
+    if (!entry->dup) pcmt+=bbb_store_pcm_weight(entry->pcm);
+  }
+  return pcmt;
+}
+
+int bbb_store_get_pinned_memory_estimate(const struct bbb_store *store) {
+  if (!store) return 0;
+  bbb_store_lock((struct bbb_store*)store);
+  int pcmt=bbb_store_count_pinned(0,store);
+  bbb_store_unlock((struct bbb_store*)store);
+  return pcmt<<1;
 }
 
 int bbb_store_set_pcm_count_limit(struct bbb_store *store,int pcmc) {
   if (!store) return -1;
+  bbb_store_lock(store);
   if (pcmc>1) {
     store->limit_pcmc=pcmc;
     store->target_pcmc=pcmc>>1;
   }
-  return store->limit_pcmc;
+  int limit=store->limit_pcmc;
+  bbb_store_unlock(store);
+  return limit;
 }
 
 int bbb_store_set_memory_limit(struct bbb_store *store,int bytec) {
   if (!store) return -1;
+  bbb_store_lock(store);
   if (bytec>1) {
     store->limit_pcmt=bytec;
     store->target_pcmt=bytec>>1;
   }
-  return store->limit_pcmt;
+  int limit=store->limit_pcmt;
+  bbb_store_unlock(store);
+  return limit;
 }
 
 /* Load.
@@ -142,86 +341,368 @@ int bbb_store_load(struct bbb_store *store) {
   if (!store->configpathc) return bbb_store_load_default(store);
   
   // Read fails, eg doesn't exist, default it but issue a warning.
-  uint8_t *src=0;
-  int srcc=bb_file_read(&src,store->configpath);
-  if (srcc<0) {
+  struct bbb_archive *archive=bbb_archive_new(store->configpath);
+  if (!archive) {
     fprintf(stderr,"%s:WARNING: Failed to read file. Generating default instruments.\n",store->configpath);
     return bbb_store_load_default(store);
   }
-  
-  // Verify signature.
-  if ((srcc<4)||memcmp(src,"\x00\xbb\xbaR",4)) {
-    free(src);
+  if (bbb_archive_index(archive)<0) {
+    bbb_archive_del(archive);
     return -1;
   }
-  int srcp=4;
-  
-  // Read programs if the next byte is zero.
-  if ((srcp<srcc)&&!src[srcp]) {
-    int pid=-1;
-    while (srcp<srcc) {
-    
-      // End of program list, if the next pid is out of order.
-      if (src[srcp]<=pid) break;
-      pid=src[srcp++];
-      
-      // Measure program.
-      const void *program=src+srcp;
-      int programc=bbb_measure_program(program,srcc-srcp);
-      if (programc<0) {
-        free(src);
-        return -1;
-      }
-      srcp+=programc;
-      
-      // Install it.
-      if (bbb_store_set_program(store,pid,program,programc)<0) {
-        free(src);
-        return -1;
-      }
+  
+  // Install programs straight off the table of contents.
+  int pid=0;
+  for (;pid<256;pid++) {
+    const void *program=0;
+    int programc=bbb_archive_get_program(&program,archive,pid);
+    if (!programc) continue;
+    if (bbb_store_set_program(store,pid,program,programc)<0) {
+      bbb_archive_del(archive);
+      return -1;
     }
   }
   
-  // Further content may be defined in the future...
-  
-  free(src);
+  bbb_archive_del(store->archive);
+  store->archive=archive;
   return 0;
 }
 
-/* Install program.
+/* Ask a program which notes it plays and which velocity bits matter.
+ * We probe with pid 1 so a valid sndid can never come back zero.
  */
  
-int bbb_store_set_program(struct bbb_store *store,uint8_t pid,const void *src,int srcc) {
+static int bbb_store_probe_notes(uint16_t *dst,struct bbb_program *program) {
+  int noteid=0;
+  for (;noteid<256;noteid++) {
+    uint32_t sndid=bbb_program_pack_sndid(program,1,noteid,0xff);
+    if (!sndid) dst[noteid]=0;
+    else if ((sndid&0xffff00)!=(0x10000|(noteid<<8))) return -1;
+    else dst[noteid]=0x100|(sndid&0xff);
+  }
+  return 0;
+}
+
+/* Rebuild (routev) from scratch.
+ * We don't default to zero at the end: 0x80..0xff are presumed to be drums and foley (silence better than a tonal default).
+ */
+ 
+static void bbb_store_rebuild_routes(struct bbb_store *store) {
+  struct bbb_program **pv=store->programv;
+  int pid=0;
+  for (;pid<256;pid++) {
+         if (pv[pid]) store->routev[pid]=pid+1; // as requested
+    else if (pv[pid&~0x07]) store->routev[pid]=(pid&~0x07)+1; // start of row
+    else if (pv[pid&~0x7f]) store->routev[pid]=(pid&~0x7f)+1; // start of bank
+    else store->routev[pid]=0;
+  }
+}
+
+/* Decode a program and probe its notes, without touching the store.
+ * On success, (*dst) is a new STRONG program and (notev) is filled.
+ */
+ 
+static int bbb_store_decode_program(struct bbb_program **dst,uint16_t *notev,struct bbb_store *store,const void *src,int srcc) {
   struct bb_decoder decoder={.src=src,.srcc=srcc};
   struct bbb_program *program=bbb_program_new(store->context,&decoder);
   if (!program) return -1;
+  if (bbb_store_probe_notes(notev,program)<0) {
+    bbb_program_del(program);
+    return -1;
+  }
+  *dst=program;
+  return 0;
+}
+
+/* Install program.
+ */
+ 
+int bbb_store_set_program(struct bbb_store *store,uint8_t pid,const void *src,int srcc) {
+
+  // Decode and probe into scratch: If it fails, the old program and its notes stay as they were.
+  struct bbb_program *program=0;
+  uint16_t notev[256];
+  if (bbb_store_decode_program(&program,notev,store,src,srcc)<0) return -1;
+  if (!store->notev[pid]&&!(store->notev[pid]=bb_malloc(sizeof(notev)))) {
+    bbb_program_del(program);
+    return -1;
+  }
+  memcpy(store->notev[pid],notev,sizeof(notev));
   bbb_program_del(store->programv[pid]);
   store->programv[pid]=program;
+  bbb_store_rebuild_routes(store);
+  return 0;
+}
+
+/* Reload.
+ * Programs whose encoded bytes didn't change keep their program object, and all their cached sounds.
+ * Without an archive before (defaults), everything counts as changed.
+ */
+ 
+static int bbb_store_uncache_cb(const char *path,const char *base,char type,void *userdata) {
+  if (!type) type=bb_file_get_type(path);
+  if (type=='f') unlink(path);
+  return 0;
+}
+
+static void bbb_store_uncache_program(struct bbb_store *store,uint8_t pid) {
+  if (!store->cachepathc) return;
+  char path[1024];
+  int pathc=snprintf(path,sizeof(path),
+    "%.*s/%d/%03d",
+    store->cachepathc,store->cachepath,
+    bbb_context_get_rate(store->context),pid
+  );
+  if ((pathc<1)||(pathc>=sizeof(path))) return;
+  bb_dir_read(path,bbb_store_uncache_cb,0);
+}
+
+/* Drop every entry belonging to a program flagged in (changedv).
+ * Prints in progress lose their sndid, so when they finish they don't go back into the store or the disk cache.
+ * Voices playing these PCMs keep them and finish normally.
+ */
+ 
+static int bbb_store_evict_programs(struct bbb_store *store,const uint8_t *changedv) {
+  int rmc=0,i=store->entryc;
+  while (i-->0) {
+    struct bbb_store_entry *entry=store->entryv+i;
+    if (!changedv[(entry->sndid>>16)&0xff]) continue;
+    if (entry->printer) entry->pcm->sndid=0;
+    bbb_store_uncount(store,entry);
+    bbb_store_entry_cleanup(entry);
+    store->entryc--;
+    memmove(entry,entry+1,sizeof(struct bbb_store_entry)*(store->entryc-i));
+    rmc++;
+  }
+  return rmc;
+}
+
+/* Everything a reload installs, decoded up front so installing can't fail.
+ * Installing swaps (programv,notev,configpath,archive) with the store's, so cleanup releases the old ones.
+ */
+ 
+struct bbb_store_reload {
+  struct bbb_archive *archive;
+  char *configpath; // null to keep the store's
+  int configpathc;
+  uint8_t changedv[256];
+  int changec;
+  struct bbb_program *programv[256]; // For each changed pid, the new program, or null if it's removed.
+  uint16_t *notev[256]; // Same, for the store's note tables. Null for removed programs.
+};
+
+static void bbb_store_reload_cleanup(struct bbb_store_reload *reload) {
+  int pid=0;
+  for (;pid<256;pid++) {
+    bbb_program_del(reload->programv[pid]);
+    if (reload->notev[pid]) bb_free(reload->notev[pid]);
+  }
+  if (reload->configpath) bb_free(reload->configpath);
+  bbb_archive_del(reload->archive);
+}
+
+/* Read the new archive, work out what changed against (prev), and decode the changed programs.
+ * (hadv) says which programs the store had, for when there's no (prev), ie it's on the defaults.
+ * Returns the count of changed programs, or zero if the file is the same, or <0 if anything fails.
+ */
+ 
+static int bbb_store_reload_prepare(
+  struct bbb_store_reload *reload,
+  struct bbb_store *store,
+  const char *path,int keeppath,
+  const struct bbb_archive *prev,
+  const uint8_t *hadv
+) {
+  if (!(reload->archive=bbb_archive_new(path))) return -1;
+  if (bbb_archive_index(reload->archive)<0) return -1;
+  
+  // Same file as before? Great, nothing to do.
+  if (prev&&!memcmp(prev->digest,reload->archive->digest,sizeof(prev->digest))) return 0;
+  
+  // Which programs changed?
+  // Compare digests taken when the old archive was indexed. Its content may be mapped, and might have changed since.
+  int pid=0;
+  for (;pid<256;pid++) {
+    int nc=bbb_archive_get_program(0,reload->archive,pid);
+    if (prev) {
+      const struct bbb_archive_toc *ntoc=reload->archive->tocv+pid,*ptoc=prev->tocv+pid;
+      if ((nc==ptoc->c)&&(!nc||!memcmp(ntoc->digest,ptoc->digest,16))) continue;
+    } else {
+      if (!nc&&!hadv[pid]) continue;
+    }
+    reload->changedv[pid]=1;
+    reload->changec++;
+  }
+  
+  // Decode all of them. Any failure, and nothing gets installed.
+  for (pid=0;pid<256;pid++) {
+    if (!reload->changedv[pid]) continue;
+    const void *src=0;
+    int srcc=bbb_archive_get_program(&src,reload->archive,pid);
+    if (!srcc) continue;
+    if (!(reload->notev[pid]=bb_malloc(sizeof(uint16_t)*256))) return -1;
+    if (bbb_store_decode_program(reload->programv+pid,reload->notev[pid],store,src,srcc)<0) return -1;
+  }
+  
+  // Keep the new path, so the next reload can default to it.
+  if (keeppath) {
+    int c=0; while (path[c]) c++;
+    if (!(reload->configpath=bb_malloc(c+1))) return -1;
+    memcpy(reload->configpath,path,c+1);
+    reload->configpathc=c;
+  }
+  return reload->changec;
+}
+
+/* Install a prepared reload, all at once. Caller holds the lock.
+ */
+ 
+static void bbb_store_reload_install(struct bbb_store *store,struct bbb_store_reload *reload) {
+  int pid=0;
+  for (;pid<256;pid++) {
+    if (!reload->changedv[pid]) continue;
+    struct bbb_program *program=store->programv[pid];
+    store->programv[pid]=reload->programv[pid];
+    reload->programv[pid]=program;
+    if (store->programv[pid]) {
+      uint16_t *notev=store->notev[pid];
+      store->notev[pid]=reload->notev[pid];
+      reload->notev[pid]=notev;
+    }
+  }
+  bbb_store_rebuild_routes(store);
+  
+  // Evict changed sounds, in memory and on disk.
+  // Uncaching stays under the lock, so nobody reads an old file back in between.
+  // Shared memory is keyed to the old config, and other processes may still want it. Stop using it.
+  bbb_store_evict_programs(store,reload->changedv);
+  if (store->shm) store->shm->stale=1;
+  for (pid=0;pid<256;pid++) {
+    if (reload->changedv[pid]) bbb_store_uncache_program(store,pid);
+  }
+  
+  if (reload->configpath) {
+    char *configpath=store->configpath;
+    store->configpath=reload->configpath;
+    store->configpathc=reload->configpathc;
+    reload->configpath=configpath;
+  }
+  struct bbb_archive *archive=store->archive;
+  store->archive=reload->archive;
+  reload->archive=archive;
+}
+
+int bbb_store_reload(struct bbb_store *store,const char *path) {
+  if (!store) return -1;
+  
+  // Take what we need from the store, then let go: Reading and decoding can be slow, and other threads print and play meanwhile.
+  uint8_t hadv[256];
+  int pid=0,keeppath=1;
+  char *pathcopy=0;
+  bbb_store_lock(store);
+  if (!path) {
+    if (!store->configpathc||!(pathcopy=bb_malloc(store->configpathc+1))) {
+      bbb_store_unlock(store);
+      return -1;
+    }
+    memcpy(pathcopy,store->configpath,store->configpathc+1);
+    path=pathcopy;
+    keeppath=0;
+  }
+  struct bbb_archive *prev=store->archive;
+  if (prev&&(bbb_archive_ref(prev)<0)) prev=0;
+  for (;pid<256;pid++) hadv[pid]=store->programv[pid]?1:0;
+  bbb_store_unlock(store);
+  
+  struct bbb_store_reload reload={0};
+  int changec=bbb_store_reload_prepare(&reload,store,path,keeppath,prev,hadv);
+  
+  // Install only if nobody else reloaded while we were decoding. Otherwise our comparison is against the wrong thing.
+  if (changec>0) {
+    bbb_store_lock(store);
+    if (store->archive==prev) bbb_store_reload_install(store,&reload);
+    else changec=-1;
+    bbb_store_unlock(store);
+  }
+  
+  bbb_store_reload_cleanup(&reload);
+  bbb_archive_del(prev);
+  if (pathcopy) bb_free(pathcopy);
+  return changec;
+}
+
+/* Locking.
+ */
+ 
+void bbb_store_lock(struct bbb_store *store) {
+  pthread_mutex_lock(&store->mtx);
+}
+
+void bbb_store_unlock(struct bbb_store *store) {
+  pthread_mutex_unlock(&store->mtx);
+}
+
+/* Share.
+ * Printers lock themselves, so prints in progress carry on as they were. Only trim behaves differently.
+ */
+ 
+int bbb_store_share(struct bbb_store *store) {
+  if (!store) return -1;
+  bbb_store_lock(store);
+  store->shared=1;
+  bbb_store_unlock(store);
   return 0;
 }
 
 /* Get PCM.
  */
  
-struct bbb_pcm *bbb_store_get_pcm(
+static struct bbb_pcm *bbb_store_get_pcm_unlocked(
   struct bbb_printer **printerrtn,
   struct bbb_store *store,
   uint32_t sndid
 ) {
 
   // Already have it? Great!
+  // If it's still printing, share the printer, or finish it now if the caller wants it complete.
   int p=bbb_store_search(store,sndid);
   if (p>=0) {
+    struct bbb_store_entry *entry=store->entryv+p;
+    struct bbb_pcm *pcm=entry->pcm;
     if (printerrtn) *printerrtn=0;
-    struct bbb_pcm *pcm=store->entryv[p].pcm;
-    if (bbb_pcm_ref(pcm)<0) return 0;
-    store->entryv[p].access=store->access_next++;
+    if (entry->printer) {
+      if (printerrtn) {
+        if (bbb_printer_ref(entry->printer)<0) return 0;
+        *printerrtn=entry->printer;
+      } else {
+        if (bbb_printer_update(entry->printer,pcm->c)<0) return 0;
+      }
+    }
+    if (bbb_pcm_ref(pcm)<0) {
+      if (printerrtn&&*printerrtn) {
+        bbb_printer_del(*printerrtn);
+        *printerrtn=0;
+      }
+      return 0;
+    }
+    entry->access=store->access_next++;
+    if (store->profile) bbb_store_profile_hit(store,sndid,0);
     return pcm;
   }
   p=-p-1;
+  int64_t starttime=store->profile?bbb_store_now_us():0;
+  
+  // Did some other process already print it into shared memory?
+  struct bbb_pcm *shared=bbb_shm_get(store->shm,sndid);
+  if (shared) {
+    if (bbb_store_insert(store,p,sndid,shared)<0) return 0;
+    if (store->profile) bbb_store_profile_hit(store,sndid,bbb_store_now_us()-starttime);
+    return shared;
+  }
   
   // Can we fetch it from the disk cache?
   // Anything goes wrong, let it pass through to printing.
+  // If we have shared memory, publish it there and keep the shared copy instead.
   if (store->cachepathc) {
     char path[1024];
     int pathc=bbb_store_get_cache_path(path,sizeof(path),store,sndid);
@@ -229,8 +710,13 @@ struct bbb_pcm *bbb_store_get_pcm(
       struct bbb_pcm *pcm=bbb_store_read_cache_file(store,path);
       if (pcm) {
         pcm->sndid=sndid;
+        if ((shared=bbb_store_publish(store,sndid,pcm))) {
+          bbb_pcm_del(pcm);
+          pcm=shared;
+        }
         bbb_store_insert(store,p,sndid,pcm);
         //fprintf(stderr,"%s: Fetched sound 0x%08x from cache.\n",path,sndid);
+        if (store->profile) bbb_store_profile_hit(store,sndid,bbb_store_now_us()-starttime);
         return pcm; // handoff
       }
     }
@@ -253,76 +739,205 @@ struct bbb_pcm *bbb_store_get_pcm(
   }
   
   // If the caller did not provide a printer return vector, print the whole thing synchronously.
+  // Finishing may trim or dedup it, so the entry's pcm is the one to return.
   if (!printerrtn) {
     if (bbb_printer_update(printer,printer->pcm->c)<0) {
       bbb_printer_del(printer);
       return 0;
     }
+    bbb_store_print_finished_unlocked(store,printer->pcm);
     struct bbb_pcm *pcm=printer->pcm;
+    if ((p=bbb_store_search(store,sndid))>=0) pcm=store->entryv[p].pcm;
     if (bbb_pcm_ref(pcm)<0) {
       bbb_printer_del(printer);
       return 0;
     }
     bbb_printer_del(printer);
+    if (store->profile) bbb_store_profile_hit(store,sndid,bbb_store_now_us()-starttime);
     return pcm;
   }
   
-  // Return both objects, let the caller print it over time.
+  // Return both objects, let the caller print it over time, outside our lock.
+  // Entry keeps the printer too, so repeats before it finishes can share it, even from other threads.
   if (bbb_pcm_ref(printer->pcm)<0) {
     bbb_printer_del(printer);
     return 0;
   }
+  if (((p=bbb_store_search(store,sndid))>=0)&&(bbb_printer_ref(printer)>=0)) {
+    store->entryv[p].printer=printer;
+  }
   *printerrtn=printer;
+  if (store->profile) bbb_store_profile_hit(store,sndid,bbb_store_now_us()-starttime);
   return printer->pcm;
 }
 
+struct bbb_pcm *bbb_store_get_pcm(
+  struct bbb_printer **printerrtn,
+  struct bbb_store *store,
+  uint32_t sndid
+) {
+  bbb_store_lock(store);
+  struct bbb_pcm *pcm=bbb_store_get_pcm_unlocked(printerrtn,store,sndid);
+  bbb_store_unlock(store);
+  return pcm;
+}
+
+/* Hash index.
+ * bbb_store_hash_search() returns the first record at or after (hash,sndid), and whether it's an exact match.
+ */
+ 
+static int bbb_store_hash_search(const struct bbb_store *store,uint64_t hash,uint32_t sndid) {
+  int lo=0,hi=store->hashc;
+  while (lo<hi) {
+    int ck=(lo+hi)>>1;
+    const struct bbb_store_hash *q=store->hashv+ck;
+         if (hash<q->hash) hi=ck;
+    else if (hash>q->hash) lo=ck+1;
+    else if (sndid<q->sndid) hi=ck;
+    else if (sndid>q->sndid) lo=ck+1;
+    else return ck;
+  }
+  return -lo-1;
+}
+
+static int bbb_store_hash_add(struct bbb_store *store,uint64_t hash,uint32_t sndid) {
+  int p=bbb_store_hash_search(store,hash,sndid);
+  if (p>=0) return 0;
+  p=-p-1;
+  if (store->hashc>=store->hasha) {
+    int na=store->hasha+32;
+    if (na>INT_MAX/sizeof(struct bbb_store_hash)) return -1;
+    void *nv=bb_realloc(store->hashv,sizeof(struct bbb_store_hash)*na);
+    if (!nv) return -1;
+    store->hashv=nv;
+    store->hasha=na;
+  }
+  struct bbb_store_hash *q=store->hashv+p;
+  memmove(q+1,q,sizeof(struct bbb_store_hash)*(store->hashc-p));
+  store->hashc++;
+  q->hash=hash;
+  q->sndid=sndid;
+  return 0;
+}
+
+static void bbb_store_hash_remove(struct bbb_store *store,uint64_t hash,uint32_t sndid) {
+  int p=bbb_store_hash_search(store,hash,sndid);
+  if (p<0) return;
+  store->hashc--;
+  memmove(store->hashv+p,store->hashv+p+1,sizeof(struct bbb_store_hash)*(store->hashc-p));
+}
+
+/* Some other entry that shares (entry)'s pcm as a dup, or null.
+ * Entries must be in sndid order.
+ */
+ 
+static struct bbb_store_entry *bbb_store_find_dup(struct bbb_store *store,const struct bbb_store_entry *entry) {
+  int p=bbb_store_hash_search(store,entry->hash,0);
+  if (p<0) p=-p-1;
+  for (;(p<store->hashc)&&(store->hashv[p].hash==entry->hash);p++) {
+    if (store->hashv[p].sndid==entry->sndid) continue;
+    int ep=bbb_store_search(store,store->hashv[p].sndid);
+    if (ep<0) continue;
+    struct bbb_store_entry *other=store->entryv+ep;
+    if (other->dup&&(other->pcm==entry->pcm)) return other;
+  }
+  return 0;
+}
+
+/* An entry is leaving, or changing its pcm.
+ * Keep (pcmtotal,dedupt) counting each distinct pcm once, and drop it from the hash index.
+ * If it's the counted one and another entry shares it, that one takes over the count, and we return it.
+ * Entries must be in sndid order, but (entry) itself may already be out of the list.
+ */
+ 
+static struct bbb_store_entry *bbb_store_uncount(struct bbb_store *store,struct bbb_store_entry *entry) {
+  struct bbb_store_entry *heir=0;
+  if (entry->dup) {
+    store->dedupt-=entry->pcm->c;
+  } else if (entry->hash&&(heir=bbb_store_find_dup(store,entry))) {
+    heir->dup=0;
+    store->dedupt-=entry->pcm->c;
+  } else {
+    store->pcmtotal-=bbb_store_pcm_weight(entry->pcm);
+  }
+  if (entry->hash) bbb_store_hash_remove(store,entry->hash,entry->sndid);
+  entry->hash=0;
+  entry->dup=0;
+  return heir;
+}
+
 /* Check the PCM cache and evict members if too big.
  * Call this after adding or replacing anything.
  */
  
+struct bbb_store_gc_order {
+  int p; // index in (entryv)
+  uint32_t access;
+  uint8_t priority;
+};
+
 static int bbb_store_cmp_access(const void *a,const void *b) {
-  const struct bbb_store_entry *A=a,*B=b;
+  const struct bbb_store_gc_order *A=a,*B=b;
+  if (A->priority!=B->priority) return B->priority-A->priority;
   return A->access-B->access;
 }
  
-static int bbb_store_cmp_sndid(const void *a,const void *b) {
-  const struct bbb_store_entry *A=a,*B=b;
-  return A->sndid-B->sndid;
-}
- 
 static void bbb_store_gc_pcm(struct bbb_store *store) {
 
   // If entry count and total size are both within limits, do nothing.
-  if ((store->entryc<=store->limit_pcmc)&&(store->pcmtotal<=store->limit_pcmt)) return;
+  // Pinned entries don't count. Walking the list to measure them is only necessary if something is pinned.
+  int pinnedc=0,pinnedt=0;
+  if ((store->entryc>store->limit_pcmc)||(store->pcmtotal>store->limit_pcmt)) {
+    pinnedt=bbb_store_count_pinned(&pinnedc,store);
+  }
+  if ((store->entryc-pinnedc<=store->limit_pcmc)&&(store->pcmtotal-pinnedt<=store->limit_pcmt)) return;
   
-  // Reset access counters so they are in ascending order.
-  // If we left them untouched, the sequence could be interrupted once.
+  // Sort an eviction order by priority, then access order backward: Most recently-accessed PCM at the front.
+  // Pinned ones all land at the front. Entries themselves stay in sndid order, so dups can still be looked up.
+  // Reset access counters so they are in ascending order. If we left them untouched, the sequence could be interrupted once.
+  struct bbb_store_gc_order *orderv=bb_malloc(sizeof(struct bbb_store_gc_order)*store->entryc);
+  if (!orderv) return;
   struct bbb_store_entry *entry=store->entryv;
-  int i=store->entryc;
-  for (;i-->0;entry++) entry->access=store->access_next-entry->access;
-  
-  // Sort entries by access order backward: Most recently-accessed PCM at the front.
-  qsort(store->entryv,store->entryc,sizeof(struct bbb_store_entry),bbb_store_cmp_access);
+  int i=0;
+  for (;i<store->entryc;i++,entry++) {
+    orderv[i].p=i;
+    orderv[i].access=store->access_next-entry->access;
+    orderv[i].priority=entry->priority;
+  }
+  qsort(orderv,store->entryc,sizeof(struct bbb_store_gc_order),bbb_store_cmp_access);
   
-  // Drop PCMs from the tail until both targets are met.
-  int rmc=0;
-  while (store->entryc>0) {
-    if ((store->entryc<=store->target_pcmc)&&(store->pcmtotal<=store->target_pcmt)) break;
+  // Drop PCMs from the tail until both targets are met, or we reach the pinned ones.
+  // Evicted entries stay in place with a null (pcm) until we're done.
+  int rmc=0,keepc=store->entryc;
+  while (keepc>0) {
+    if ((keepc-pinnedc<=store->target_pcmc)&&(store->pcmtotal-pinnedt<=store->target_pcmt)) break;
+    entry=store->entryv+orderv[keepc-1].p;
+    if (entry->priority==BBB_PRIORITY_PINNED) break;
     rmc++;
-    store->entryc--;
-    entry=store->entryv+store->entryc;
-    store->pcmtotal-=entry->pcm->c;
+    keepc--;
+    // If a pinned dup takes over this pcm's count, its samples are pinned now.
+    struct bbb_store_entry *heir=bbb_store_uncount(store,entry);
+    if (heir&&(heir->priority==BBB_PRIORITY_PINNED)) pinnedt+=bbb_store_pcm_weight(entry->pcm);
     bbb_store_entry_cleanup(entry);
+    entry->pcm=0;
+    entry->printer=0;
   }
   
   // Reset access.
   store->access_next=0;
-  for (i=store->entryc,entry=store->entryv;i-->0;entry++) {
-    entry->access=store->access_next++;
+  for (i=0;i<keepc;i++) {
+    store->entryv[orderv[i].p].access=store->access_next++;
   }
+  bb_free(orderv);
   
-  // Restore natural order (by sndid).
-  qsort(store->entryv,store->entryc,sizeof(struct bbb_store_entry),bbb_store_cmp_sndid);
+  // Close the gaps.
+  struct bbb_store_entry *dst=store->entryv;
+  for (i=store->entryc,entry=store->entryv;i-->0;entry++) {
+    if (!entry->pcm) continue;
+    if (dst!=entry) *dst=*entry;
+    dst++;
+  }
+  store->entryc=keepc;
   
   //fprintf(stderr,"*** bbb evicted %d PCM entries. now count=%d total=%d\n",rmc,store->entryc,store->pcmtotal);
   store->evictionc++;
@@ -350,7 +965,7 @@ int bbb_store_insert(struct bbb_store *store,int p,uint32_t sndid,struct bbb_pcm
   if (store->entryc>=store->entrya) {
     int na=store->entrya+32;
     if (na>INT_MAX/sizeof(struct bbb_store_entry)) return -1;
-    void *nv=realloc(store->entryv,sizeof(struct bbb_store_entry)*na);
+    void *nv=bb_realloc(store->entryv,sizeof(struct bbb_store_entry)*na);
     if (!nv) return -1;
     store->entryv=nv;
     store->entrya=na;
@@ -364,9 +979,13 @@ int bbb_store_insert(struct bbb_store *store,int p,uint32_t sndid,struct bbb_pcm
   
   entry->sndid=sndid;
   entry->pcm=pcm;
+  entry->printer=0;
   entry->access=store->access_next++;
-  store->pcmtotal+=pcm->c;
-  pcm->sndid=sndid;
+  entry->hash=0;
+  entry->dup=0;
+  entry->priority=bbb_store_priority_for_sndid(store,sndid);
+  store->pcmtotal+=bbb_store_pcm_weight(pcm);
+  if (pcm->refc!=BBB_PCM_REFC_STATIC) pcm->sndid=sndid; // Shared pcms are read-only.
   
   bbb_store_gc_pcm(store);
   
@@ -377,10 +996,12 @@ int bbb_store_replace(struct bbb_store *store,int p,struct bbb_pcm *pcm) {
   if ((p<0)||(p>=store->entryc)) return -1;
   struct bbb_store_entry *entry=store->entryv+p;
   if (bbb_pcm_ref(pcm)<0) return -1;
-  store->pcmtotal-=entry->pcm->c;
-  store->pcmtotal+=pcm->c;
+  bbb_store_uncount(store,entry);
+  store->pcmtotal+=bbb_store_pcm_weight(pcm);
   bbb_pcm_del(entry->pcm);
   entry->pcm=pcm;
+  bbb_printer_del(entry->printer);
+  entry->printer=0;
   entry->access=store->access_next++;
   bbb_store_gc_pcm(store);
   return 0;
@@ -465,20 +1086,20 @@ static struct bbb_pcm *bbb_store_read_cache_file(struct bbb_store *store,const c
   
   // Minimum length 6: 4-byte header plus at least one sample.
   if (srcc<6) {
-    free(src);
+    bb_free(src);
     return 0;
   }
   int samplec=(srcc-4)>>1;
   struct bbb_pcm *pcm=bbb_pcm_new(samplec);
   if (!pcm) {
-    free(src);
+    bb_free(src);
     return 0;
   }
   
   pcm->loopa=(src[0]<<8)|src[1];
   pcm->loopz=(src[2]<<8)|src[3];
   memcpy(pcm->v,src+4,samplec<<1);
-  free(src);
+  bb_free(src);
   
   if ((pcm->loopa>pcm->loopz)||(pcm->loopz>pcm->c)) {
     fprintf(stderr,"%s:WARNING: Invalid loop %d..%d (c=%d).\n",path,pcm->loopa,pcm->loopz,pcm->c);
@@ -489,13 +1110,151 @@ static struct bbb_pcm *bbb_store_read_cache_file(struct bbb_store *store,const c
   return pcm;
 }
 
-/* Print finished: Consider persisting to disk cache.
+/* Trim: Drop the inaudible tail of a freshly printed pcm.
+ * Release legs spend a while near zero before the envelope formally ends.
+ * Sustainable pcms keep at least through (loopz).
+ * The pcm shrinks in place, so voices already playing it stop early too.
+ * But we can't move it, they hold pointers. If it's worth the copy, the store gets a right-sized one.
+ * Once shared, voices on other threads may be reading it right now, so it's a copy or nothing.
+ * Returns WEAK, whichever pcm the entry ends up with.
  */
  
-int bbb_store_print_finished(struct bbb_store *store,struct bbb_pcm *pcm) {
+#define BBB_TRIM_COPY_MIN 1024 /* samples */
 
+static struct bbb_pcm *bbb_store_trim(struct bbb_store *store,struct bbb_pcm *pcm) {
+  if (store->trim<0) return pcm;
+  int p=bbb_store_search(store,pcm->sndid);
+  if (p<0) return pcm;
+  struct bbb_store_entry *entry=store->entryv+p;
+  if ((entry->pcm!=pcm)||entry->dup||pcm->inprogress) return pcm;
+  
+  int min=(pcm->loopa<pcm->loopz)?pcm->loopz:1;
+  int c=pcm->c;
+  const int16_t *v=pcm->v+c;
+  while (c>min) {
+    v--;
+    if ((*v>store->trim)||(*v<-store->trim)) break;
+    c--;
+  }
+  if (c>=pcm->c) return pcm;
+  int rmc=pcm->c-c;
+  if (!store->shared) {
+    pcm->c=c;
+    pcm->readyc=c;
+  }
+  
+  if (rmc>=BBB_TRIM_COPY_MIN) {
+    struct bbb_pcm *copy=bbb_pcm_new(c);
+    if (copy) {
+      memcpy(copy->v,pcm->v,c<<1);
+      copy->loopa=pcm->loopa;
+      copy->loopz=pcm->loopz;
+      copy->sndid=pcm->sndid;
+      bbb_pcm_del(entry->pcm);
+      entry->pcm=copy;
+      store->pcmtotal-=rmc;
+      return copy;
+    }
+  }
+  if (store->shared) return pcm;
+  store->pcmtotal-=rmc;
+  return pcm;
+}
+
+/* Dedup: Hash a freshly printed pcm, and if an identical one is already in the store, share that instead.
+ * FNV-1a over the samples and loop points; a match is confirmed by comparing content.
+ * Returns WEAK, whichever pcm the entry ends up with.
+ */
+ 
+static uint64_t bbb_pcm_hash(const struct bbb_pcm *pcm) {
+  uint64_t hash=0xcbf29ce484222325ull;
+  #define MIX(n) { hash^=(uint16_t)(n); hash*=0x100000001b3ull; }
+  MIX(pcm->c)
+  MIX(pcm->c>>16)
+  MIX(pcm->loopa)
+  MIX(pcm->loopz)
+  const int16_t *v=pcm->v;
+  int i=pcm->c;
+  for (;i-->0;v++) MIX(*v)
+  #undef MIX
+  return hash?hash:1;
+}
+
+static struct bbb_pcm *bbb_store_dedup(struct bbb_store *store,struct bbb_pcm *pcm) {
+  if (!store->dedup) return pcm;
+  int p=bbb_store_search(store,pcm->sndid);
+  if (p<0) return pcm;
+  struct bbb_store_entry *entry=store->entryv+p;
+  if ((entry->pcm!=pcm)||entry->hash) return pcm;
+  uint64_t hash=bbb_pcm_hash(pcm);
+  if (bbb_store_hash_add(store,hash,entry->sndid)<0) return pcm;
+  entry->hash=hash;
+  
+  // Candidates are the other entries with the same hash. Only the counted one of each pcm, its dups are the same thing.
+  int hp=bbb_store_hash_search(store,hash,0);
+  if (hp<0) hp=-hp-1;
+  for (;(hp<store->hashc)&&(store->hashv[hp].hash==hash);hp++) {
+    int op=bbb_store_search(store,store->hashv[hp].sndid);
+    if (op<0) continue;
+    struct bbb_store_entry *other=store->entryv+op;
+    if ((other->pcm==pcm)||other->dup) continue;
+    if (other->pcm->c!=pcm->c) continue;
+    if ((other->pcm->loopa!=pcm->loopa)||(other->pcm->loopz!=pcm->loopz)) continue;
+    if (memcmp(other->pcm->v,pcm->v,pcm->c<<1)) continue;
+    if (bbb_pcm_ref(other->pcm)<0) return pcm;
+    store->pcmtotal-=pcm->c;
+    store->dedupt+=pcm->c;
+    bbb_pcm_del(entry->pcm); // Voices playing it keep their own reference.
+    entry->pcm=other->pcm;
+    entry->dup=1;
+    return entry->pcm;
+  }
+  return pcm;
+}
+
+/* Copy a finished pcm into the shared-memory tier, if we have one.
+ * Returns WEAK, the shared copy, which might have been published by someone else. Null if none.
+ */
+ 
+static struct bbb_pcm *bbb_store_publish(struct bbb_store *store,uint32_t sndid,const struct bbb_pcm *pcm) {
+  if (!store->shm) return 0;
+  if (bbb_shm_put(store->shm,sndid,pcm)<0) return 0;
+  return bbb_shm_get(store->shm,sndid);
+}
+
+/* Print finished: Consider persisting to disk cache.
+ */
+ 
+static int bbb_store_print_finished_unlocked(struct bbb_store *store,struct bbb_pcm *pcm) {
+  
+  // Drop the entry's printer, nobody else needs to share it.
+  uint32_t sndid=pcm->sndid;
+  int p=bbb_store_search(store,sndid),failed=0;
+  if ((p>=0)&&(store->entryv[p].pcm==pcm)&&store->entryv[p].printer) {
+    failed=store->entryv[p].printer->failed;
+    bbb_printer_del(store->entryv[p].printer);
+    store->entryv[p].printer=0;
+  }
+  
+  // A failed print is mostly silence. Keep playing it, but don't trim, share, or persist it.
+  if (failed) return 0;
+  
+  // Trim and dedup may replace it. Content doesn't change after trimming, but (sndid) might if deduped.
+  pcm=bbb_store_trim(store,pcm);
+  pcm=bbb_store_dedup(store,pcm);
+  
+  // Publish to shared memory, and if the entry still has its own copy, swap in the shared one.
+  if (sndid) {
+    struct bbb_pcm *shared=bbb_store_publish(store,sndid,pcm);
+    if (shared&&((p=bbb_store_search(store,sndid))>=0)&&(store->entryv[p].pcm==pcm)&&!store->entryv[p].dup) {
+      store->pcmtotal-=bbb_store_pcm_weight(pcm);
+      bbb_pcm_del(pcm); // Voices playing it keep their own reference.
+      store->entryv[p].pcm=shared;
+      pcm=shared;
+    }
+  }
+  
   // Get out quick if we don't do disk cache.
-  if (!store||!pcm) return -1;
   if (!store->cachepathc) return 0;
   
   // Loop points get stored in 16 bits.
@@ -503,9 +1262,9 @@ int bbb_store_print_finished(struct bbb_store *store,struct bbb_pcm *pcm) {
   if ((pcm->loopa&0xffff0000)||(pcm->loopz&0xffff0000)) return 0;
   
   // Is this PCM one of ours? 
-  if (!pcm->sndid) return 0;
+  if (!sndid) return 0;
   char path[1024];
-  int pathc=bbb_store_get_cache_path(path,sizeof(path),store,pcm->sndid);
+  int pathc=bbb_store_get_cache_path(path,sizeof(path),store,sndid);
   if ((pathc<1)||(pathc>=sizeof(path))) return 0;
   
   // Write it.
@@ -522,37 +1281,323 @@ int bbb_store_print_finished(struct bbb_store *store,struct bbb_pcm *pcm) {
   return 0;
 }
 
+int bbb_store_print_finished(struct bbb_store *store,struct bbb_pcm *pcm) {
+  if (!store||!pcm) return -1;
+  bbb_store_lock(store);
+  int err=bbb_store_print_finished_unlocked(store,pcm);
+  bbb_store_unlock(store);
+  return err;
+}
+
+/* Printer for a pcm still in progress.
+ */
+ 
+struct bbb_printer *bbb_store_get_printer(struct bbb_store *store,const struct bbb_pcm *pcm) {
+  if (!store||!pcm||!pcm->inprogress) return 0;
+  struct bbb_printer *printer=0;
+  bbb_store_lock(store);
+  int p=bbb_store_search(store,pcm->sndid);
+  if ((p>=0)&&(store->entryv[p].pcm==pcm)&&store->entryv[p].printer) {
+    if (bbb_printer_ref(store->entryv[p].printer)>=0) printer=store->entryv[p].printer;
+  }
+  bbb_store_unlock(store);
+  return printer;
+}
+
+/* Bounced songs.
+ * These go under the rate directory, beside the per-program ones: "bounce/SONGDIGEST-ARCHIVEDIGEST".
+ * Header is 8 bytes: loopa and loopz, 32 bits each, big-endian. Then samples, same as the others.
+ */
+ 
+void bbb_store_get_archive_digest(uint8_t *dst,const struct bbb_store *store) {
+  if (store->archive) memcpy(dst,store->archive->digest,16);
+  else bbb_store_get_default_digest(dst);
+}
+
+static int bbb_store_get_bounce_path(char *dst,int dsta,struct bbb_store *store,const uint8_t *songdigest) {
+  if (!store->cachepathc) return -1;
+  char songhex[32],archivehex[32];
+  uint8_t archivedigest[16];
+  bbb_store_get_archive_digest(archivedigest,store);
+  if (bb_hexstring_encode(songhex,sizeof(songhex),songdigest,16)!=sizeof(songhex)) return -1;
+  if (bb_hexstring_encode(archivehex,sizeof(archivehex),archivedigest,16)!=sizeof(archivehex)) return -1;
+  int dstc=snprintf(dst,dsta,
+    "%.*s/%d/bounce/%.32s-%.32s",
+    store->cachepathc,store->cachepath,
+    bbb_context_get_rate(store->context),
+    songhex,archivehex
+  );
+  if ((dstc<1)||(dstc>=dsta)) return -1;
+  return dstc;
+}
+
+struct bbb_pcm *bbb_store_get_bounce(struct bbb_store *store,const uint8_t *songdigest) {
+  char path[1024];
+  int pathc=bbb_store_get_bounce_path(path,sizeof(path),store,songdigest);
+  if ((pathc<1)||(pathc>=sizeof(path))) return 0;
+  uint8_t *src=0;
+  int srcc=bb_file_read(&src,path);
+  if (srcc<0) return 0;
+  if (srcc<10) {
+    bb_free(src);
+    return 0;
+  }
+  int samplec=(srcc-8)>>1;
+  struct bbb_pcm *pcm=bbb_pcm_new(samplec);
+  if (!pcm) {
+    bb_free(src);
+    return 0;
+  }
+  pcm->loopa=(src[0]<<24)|(src[1]<<16)|(src[2]<<8)|src[3];
+  pcm->loopz=(src[4]<<24)|(src[5]<<16)|(src[6]<<8)|src[7];
+  memcpy(pcm->v,src+8,samplec<<1);
+  bb_free(src);
+  if ((pcm->loopa<0)||(pcm->loopa>=pcm->loopz)||(pcm->loopz>pcm->c)) {
+    bbb_pcm_del(pcm);
+    return 0;
+  }
+  return pcm;
+}
+
+int bbb_store_set_bounce(struct bbb_store *store,const uint8_t *songdigest,const struct bbb_pcm *pcm) {
+  char path[1024];
+  int pathc=bbb_store_get_bounce_path(path,sizeof(path),store,songdigest);
+  if ((pathc<1)||(pathc>=sizeof(path))) return 0;
+  int fd=bbb_store_cache_openw(store,path);
+  if (fd<0) return -1;
+  uint8_t hdr[8]={
+    pcm->loopa>>24,pcm->loopa>>16,pcm->loopa>>8,pcm->loopa,
+    pcm->loopz>>24,pcm->loopz>>16,pcm->loopz>>8,pcm->loopz,
+  };
+  int wrc=pcm->c<<1;
+  if ((write(fd,hdr,sizeof(hdr))!=sizeof(hdr))||(write(fd,pcm->v,wrc)!=wrc)) {
+    close(fd);
+    unlink(path);
+    return -1;
+  }
+  close(fd);
+  return 0;
+}
+
+/* Snapshot of the resident set.
+ * Header:
+ *   4 Signature: "\0\xbbSN"
+ *   4 Rate, big-endian. Must match the context's (internal) rate.
+ *  16 Archive digest, or digest of the default programs. Must match.
+ *   4 Entry count, big-endian.
+ * Then for each entry, most recently used first:
+ *   4 sndid
+ *   4 loopa
+ *   4 loopz
+ *   4 Sample count
+ *   ... Samples, same as the cache files.
+ * Prints in progress are not included.
+ */
+ 
+#define BBB_SNAPSHOT_HDR_SIZE 28
+#define BBB_SNAPSHOT_ENTRY_SIZE 16
+
+static int bbb_store_cmp_access_desc(const void *a,const void *b) {
+  const struct bbb_store_entry *A=*(const struct bbb_store_entry**)a;
+  const struct bbb_store_entry *B=*(const struct bbb_store_entry**)b;
+  if (A->access>B->access) return -1;
+  if (A->access<B->access) return 1;
+  return 0;
+}
+
+static int bbb_store_save_snapshot_unlocked(struct bbb_store *store,const char *path) {
+  if (!store||!path) return -1;
+  
+  // Collect the finished entries, most recent first.
+  struct bbb_store_entry **entryv=0;
+  if (store->entryc&&!(entryv=bb_malloc(sizeof(void*)*store->entryc))) return -1;
+  int entryc=0,i=0;
+  for (;i<store->entryc;i++) {
+    struct bbb_store_entry *entry=store->entryv+i;
+    if (entry->printer||entry->pcm->inprogress) continue;
+    entryv[entryc++]=entry;
+  }
+  qsort(entryv,entryc,sizeof(void*),bbb_store_cmp_access_desc);
+  
+  int fd=open(path,O_WRONLY|O_CREAT|O_TRUNC|O_BINARY,0666);
+  if (fd<0) {
+    if (entryv) bb_free(entryv);
+    return -1;
+  }
+  
+  int rate=bbb_context_get_rate(store->context);
+  uint8_t hdr[BBB_SNAPSHOT_HDR_SIZE]={
+    0x00,0xbb,'S','N',
+    rate>>24,rate>>16,rate>>8,rate,
+  };
+  bbb_store_get_archive_digest(hdr+8,store);
+  hdr[24]=entryc>>24;
+  hdr[25]=entryc>>16;
+  hdr[26]=entryc>>8;
+  hdr[27]=entryc;
+  int err=(write(fd,hdr,sizeof(hdr))==sizeof(hdr))?0:-1;
+  
+  for (i=0;(err>=0)&&(i<entryc);i++) {
+    const struct bbb_store_entry *entry=entryv[i];
+    const struct bbb_pcm *pcm=entry->pcm;
+    uint8_t ehdr[BBB_SNAPSHOT_ENTRY_SIZE]={
+      entry->sndid>>24,entry->sndid>>16,entry->sndid>>8,entry->sndid,
+      pcm->loopa>>24,pcm->loopa>>16,pcm->loopa>>8,pcm->loopa,
+      pcm->loopz>>24,pcm->loopz>>16,pcm->loopz>>8,pcm->loopz,
+      pcm->c>>24,pcm->c>>16,pcm->c>>8,pcm->c,
+    };
+    int wrc=pcm->c<<1;
+    if (write(fd,ehdr,sizeof(ehdr))!=sizeof(ehdr)) err=-1;
+    else if (write(fd,pcm->v,wrc)!=wrc) err=-1;
+  }
+  
+  close(fd);
+  if (entryv) bb_free(entryv);
+  if (err<0) {
+    unlink(path);
+    return -1;
+  }
+  return entryc;
+}
+
+int bbb_store_save_snapshot(struct bbb_store *store,const char *path) {
+  if (!store) return -1;
+  bbb_store_lock(store);
+  int err=bbb_store_save_snapshot_unlocked(store,path);
+  bbb_store_unlock(store);
+  return err;
+}
+
+/* Load snapshot.
+ * Walk the whole thing first, to find the most recent entries that fit within our limits.
+ * Then insert them oldest first, so access order comes out the same as when saved.
+ */
+ 
+static int bbb_store_load_snapshot_src(struct bbb_store *store,const uint8_t *src,int srcc) {
+
+  if ((srcc<BBB_SNAPSHOT_HDR_SIZE)||memcmp(src,"\0\xbbSN",4)) return -1;
+  int rate,entryc;
+  bb_intbe_decode(&rate,src+4,4,4);
+  bb_intbe_decode(&entryc,src+24,4,4);
+  if (entryc<0) return -1;
+  
+  // Stale snapshots are not an error, just useless.
+  uint8_t digest[16];
+  bbb_store_get_archive_digest(digest,store);
+  if (rate!=bbb_context_get_rate(store->context)) return 0;
+  if (memcmp(digest,src+8,16)) return 0;
+  
+  int *offsetv=0;
+  if (entryc&&!(offsetv=bb_malloc(sizeof(int)*entryc))) return -1;
+  int srcp=BBB_SNAPSHOT_HDR_SIZE,i=0;
+  int loadc=0,total=store->pcmtotal,count=store->entryc;
+  for (;i<entryc;i++) {
+    if (srcp>srcc-BBB_SNAPSHOT_ENTRY_SIZE) break;
+    int sndid,loopa,loopz,c;
+    bb_intbe_decode(&sndid,src+srcp,4,4);
+    bb_intbe_decode(&loopa,src+srcp+4,4,4);
+    bb_intbe_decode(&loopz,src+srcp+8,4,4);
+    bb_intbe_decode(&c,src+srcp+12,4,4);
+    if (!sndid||(sndid&0xff000000)) break;
+    if ((c<1)||(c>(srcc-srcp-BBB_SNAPSHOT_ENTRY_SIZE)>>1)) break;
+    if ((loopa<0)||(loopz<loopa)||(loopz>c)) break;
+    if (bbb_store_search(store,sndid)<0) {
+      if (count>=store->limit_pcmc) break;
+      if (total>store->limit_pcmt-c) break;
+      count++;
+      total+=c;
+      offsetv[loadc++]=srcp;
+    }
+    srcp+=BBB_SNAPSHOT_ENTRY_SIZE+(c<<1);
+  }
+  
+  int insertc=0;
+  for (i=loadc;i-->0;) {
+    const uint8_t *esrc=src+offsetv[i];
+    int sndid,c;
+    bb_intbe_decode(&sndid,esrc,4,4);
+    bb_intbe_decode(&c,esrc+12,4,4);
+    int p=bbb_store_search(store,sndid);
+    if (p>=0) continue; // Duplicate in the file, whatever.
+    p=-p-1;
+    struct bbb_pcm *pcm=bbb_pcm_new(c);
+    if (!pcm) break;
+    bb_intbe_decode(&pcm->loopa,esrc+4,4,4);
+    bb_intbe_decode(&pcm->loopz,esrc+8,4,4);
+    memcpy(pcm->v,esrc+BBB_SNAPSHOT_ENTRY_SIZE,c<<1);
+    if (bbb_store_insert(store,p,sndid,pcm)<0) {
+      bbb_pcm_del(pcm);
+      break;
+    }
+    bbb_store_dedup(store,pcm);
+    bbb_pcm_del(pcm);
+    insertc++;
+  }
+  
+  if (offsetv) bb_free(offsetv);
+  return insertc;
+}
+
+static int bbb_store_load_snapshot_unlocked(struct bbb_store *store,const char *path) {
+  if (!store||!path) return -1;
+  void *src=0;
+  int srcc=bb_file_map(&src,path);
+  if (srcc>0) {
+    int err=bbb_store_load_snapshot_src(store,src,srcc);
+    bb_file_unmap(src,srcc);
+    return err;
+  }
+  if ((srcc=bb_file_read(&src,path))<0) return -1;
+  int err=bbb_store_load_snapshot_src(store,src,srcc);
+  bb_free(src);
+  return err;
+}
+
+int bbb_store_load_snapshot(struct bbb_store *store,const char *path) {
+  if (!store) return -1;
+  bbb_store_lock(store);
+  int err=bbb_store_load_snapshot_unlocked(store,path);
+  bbb_store_unlock(store);
+  return err;
+}
+
 /* Ad-hoc wave generator and cache.
  */
  
 struct bbb_wave *bbb_wave_get_sine(struct bbb_context *context) {
   struct bbb_store *store=context?context->store:0;
   if (!store) return 0;
-  if (!store->wave_sine) {
-    if (!(store->wave_sine=bbb_wave_new())) return 0;
-    bbb_wave_generate_sine(store->wave_sine->v,BBB_WAVE_SIZE);
+  bbb_store_lock(store);
+  if (!store->wave_sine&&(store->wave_sine=bbb_wave_new())) {
+    bbb_wave_generate_standard(store->wave_sine->v,BBB_SHAPE_SINE);
   }
-  return store->wave_sine;
+  struct bbb_wave *wave=store->wave_sine;
+  bbb_store_unlock(store);
+  return wave;
 }
 
 struct bbb_wave *bbb_wave_get_losquare(struct bbb_context *context) {
   struct bbb_store *store=context?context->store:0;
   if (!store) return 0;
-  if (!store->wave_losquare) {
-    if (!(store->wave_losquare=bbb_wave_new())) return 0;
-    bbb_wave_generate_losquare(store->wave_losquare->v,BBB_WAVE_SIZE,32000,0.15);
+  bbb_store_lock(store);
+  if (!store->wave_losquare&&(store->wave_losquare=bbb_wave_new())) {
+    bbb_wave_generate_standard(store->wave_losquare->v,BBB_SHAPE_LOSQUARE);
   }
-  return store->wave_losquare;
+  struct bbb_wave *wave=store->wave_losquare;
+  bbb_store_unlock(store);
+  return wave;
 }
 
 struct bbb_wave *bbb_wave_get_losaw(struct bbb_context *context) {
   struct bbb_store *store=context?context->store:0;
   if (!store) return 0;
-  if (!store->wave_losaw) {
-    if (!(store->wave_losaw=bbb_wave_new())) return 0;
-    bbb_wave_generate_losaw(store->wave_losaw->v,BBB_WAVE_SIZE,150.0);
+  bbb_store_lock(store);
+  if (!store->wave_losaw&&(store->wave_losaw=bbb_wave_new())) {
+    bbb_wave_generate_standard(store->wave_losaw->v,BBB_SHAPE_LOSAW);
   }
-  return store->wave_losaw;
+  struct bbb_wave *wave=store->wave_losaw;
+  bbb_store_unlock(store);
+  return wave;
 }
 
 /* Convenience wave generator.
@@ -0,0 +1,234 @@
+#include "bbb_context_internal.h"
+#include "share/bb_fs.h"
+#include "share/bb_serial.h"
+#include <time.h>
+
+/* Profile file format:
+ *   4 Signature: "\0\xbbPF"
+ *  16 Archive digest, or digest of the default programs. Must match.
+ *   4 Entry count, big-endian.
+ * Then for each entry, sorted by sndid:
+ *   4 sndid
+ *   4 Hit count
+ *   4 First-use latency, microseconds
+ */
+ 
+#define BBB_PROFILE_HDR_SIZE 24
+#define BBB_PROFILE_ENTRY_SIZE 12
+
+/* Microseconds on a monotonic clock.
+ */
+ 
+int64_t bbb_store_now_us(void) {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (int64_t)tv.tv_sec*1000000+tv.tv_nsec/1000;
+}
+
+/* Enable.
+ */
+ 
+int bbb_store_set_profiling(struct bbb_store *store,int enable) {
+  if (!store) return -1;
+  bbb_store_lock(store);
+  store->profile=enable?1:0;
+  bbb_store_unlock(store);
+  return 0;
+}
+
+/* Profile list.
+ */
+ 
+static int bbb_store_profile_search(const struct bbb_store *store,uint32_t sndid) {
+  int lo=0,hi=store->profilec;
+  while (lo<hi) {
+    int ck=(lo+hi)>>1;
+         if (sndid<store->profilev[ck].sndid) hi=ck;
+    else if (sndid>store->profilev[ck].sndid) lo=ck+1;
+    else return ck;
+  }
+  return -lo-1;
+}
+
+static struct bbb_store_profile *bbb_store_profile_get(struct bbb_store *store,uint32_t sndid) {
+  int p=bbb_store_profile_search(store,sndid);
+  if (p>=0) return store->profilev+p;
+  p=-p-1;
+  if (store->profilec>=store->profilea) {
+    int na=store->profilea+256;
+    if (na>INT_MAX/sizeof(struct bbb_store_profile)) return 0;
+    void *nv=bb_realloc(store->profilev,sizeof(struct bbb_store_profile)*na);
+    if (!nv) return 0;
+    store->profilev=nv;
+    store->profilea=na;
+  }
+  struct bbb_store_profile *profile=store->profilev+p;
+  memmove(profile+1,profile,sizeof(struct bbb_store_profile)*(store->profilec-p));
+  store->profilec++;
+  memset(profile,0,sizeof(struct bbb_store_profile));
+  profile->sndid=sndid;
+  return profile;
+}
+
+/* Record a hit.
+ */
+ 
+void bbb_store_profile_hit(struct bbb_store *store,uint32_t sndid,int us) {
+  struct bbb_store_profile *profile=bbb_store_profile_get(store,sndid);
+  if (!profile) return;
+  if (profile->hitc<UINT32_MAX) profile->hitc++;
+  if ((us>0)&&!profile->latency) profile->latency=us;
+}
+
+/* Save.
+ */
+ 
+static int bbb_store_save_profile_unlocked(struct bbb_store *store,const char *path) {
+  if (!store||!path) return -1;
+  if (store->profilec>(INT_MAX-BBB_PROFILE_HDR_SIZE)/BBB_PROFILE_ENTRY_SIZE) return -1;
+  int dstc=BBB_PROFILE_HDR_SIZE+store->profilec*BBB_PROFILE_ENTRY_SIZE;
+  uint8_t *dst=bb_malloc(dstc);
+  if (!dst) return -1;
+  
+  memcpy(dst,"\0\xbbPF",4);
+  bbb_store_get_archive_digest(dst+4,store);
+  dst[20]=store->profilec>>24;
+  dst[21]=store->profilec>>16;
+  dst[22]=store->profilec>>8;
+  dst[23]=store->profilec;
+  
+  uint8_t *p=dst+BBB_PROFILE_HDR_SIZE;
+  const struct bbb_store_profile *profile=store->profilev;
+  int i=store->profilec;
+  for (;i-->0;profile++,p+=BBB_PROFILE_ENTRY_SIZE) {
+    p[0]=profile->sndid>>24; p[1]=profile->sndid>>16; p[2]=profile->sndid>>8; p[3]=profile->sndid;
+    p[4]=profile->hitc>>24; p[5]=profile->hitc>>16; p[6]=profile->hitc>>8; p[7]=profile->hitc;
+    p[8]=profile->latency>>24; p[9]=profile->latency>>16; p[10]=profile->latency>>8; p[11]=profile->latency;
+  }
+  
+  int err=bb_file_write(path,dst,dstc);
+  bb_free(dst);
+  if (err<0) return -1;
+  return store->profilec;
+}
+
+int bbb_store_save_profile(struct bbb_store *store,const char *path) {
+  if (!store) return -1;
+  bbb_store_lock(store);
+  int err=bbb_store_save_profile_unlocked(store,path);
+  bbb_store_unlock(store);
+  return err;
+}
+
+/* Load, adding to what we've recorded so far.
+ */
+ 
+static int bbb_store_load_profile_unlocked(struct bbb_store *store,const char *path) {
+  if (!store||!path) return -1;
+  uint8_t *src=0;
+  int srcc=bb_file_read(&src,path);
+  if (srcc<0) return -1;
+  
+  if ((srcc<BBB_PROFILE_HDR_SIZE)||memcmp(src,"\0\xbbPF",4)) {
+    bb_free(src);
+    return -1;
+  }
+  
+  // Profile from some other config is not an error, just useless.
+  uint8_t digest[16];
+  bbb_store_get_archive_digest(digest,store);
+  if (memcmp(digest,src+4,16)) {
+    bb_free(src);
+    return 0;
+  }
+  
+  int entryc=(src[20]<<24)|(src[21]<<16)|(src[22]<<8)|src[23];
+  if ((entryc<0)||(entryc>(srcc-BBB_PROFILE_HDR_SIZE)/BBB_PROFILE_ENTRY_SIZE)) {
+    bb_free(src);
+    return -1;
+  }
+  
+  const uint8_t *p=src+BBB_PROFILE_HDR_SIZE;
+  int i=entryc;
+  for (;i-->0;p+=BBB_PROFILE_ENTRY_SIZE) {
+    uint32_t sndid=(p[0]<<24)|(p[1]<<16)|(p[2]<<8)|p[3];
+    uint32_t hitc=(p[4]<<24)|(p[5]<<16)|(p[6]<<8)|p[7];
+    uint32_t latency=(p[8]<<24)|(p[9]<<16)|(p[10]<<8)|p[11];
+    if (!sndid||(sndid&0xff000000)) continue;
+    struct bbb_store_profile *profile=bbb_store_profile_get(store,sndid);
+    if (!profile) {
+      bb_free(src);
+      return -1;
+    }
+    if (profile->hitc>UINT32_MAX-hitc) profile->hitc=UINT32_MAX;
+    else profile->hitc+=hitc;
+    if (!profile->latency) profile->latency=latency;
+  }
+  
+  bb_free(src);
+  return entryc;
+}
+
+int bbb_store_load_profile(struct bbb_store *store,const char *path) {
+  if (!store) return -1;
+  bbb_store_lock(store);
+  int err=bbb_store_load_profile_unlocked(store,path);
+  bbb_store_unlock(store);
+  return err;
+}
+
+/* Prewarm.
+ * Most frequent first, and the slowest to produce among equals.
+ * Memory budget is further limited by the store's eviction target, so prewarming never triggers eviction.
+ */
+ 
+static int bbb_store_profile_cmp_priority(const void *a,const void *b) {
+  const struct bbb_store_profile *A=a,*B=b;
+  if (A->hitc>B->hitc) return -1;
+  if (A->hitc<B->hitc) return 1;
+  if (A->latency>B->latency) return -1;
+  if (A->latency<B->latency) return 1;
+  return 0;
+}
+
+static int bbb_store_prewarm_unlocked(struct bbb_store *store,int pcmc,int bytec,int max_us) {
+  if (!store) return -1;
+  if ((pcmc<1)||(bytec<1)||(max_us<1)||!store->profilec) return 0;
+  int64_t deadline=bbb_store_now_us()+max_us;
+  
+  struct bbb_store_profile *orderv=bb_malloc(sizeof(struct bbb_store_profile)*store->profilec);
+  if (!orderv) return -1;
+  memcpy(orderv,store->profilev,sizeof(struct bbb_store_profile)*store->profilec);
+  qsort(orderv,store->profilec,sizeof(struct bbb_store_profile),bbb_store_profile_cmp_priority);
+  
+  // Don't count our own requests as hits.
+  int profile=store->profile;
+  store->profile=0;
+  
+  int limit=store->pcmtotal+(bytec>>1);
+  if (limit>store->target_pcmt) limit=store->target_pcmt;
+  int loadc=0,i=0;
+  for (;(i<store->profilec)&&(loadc<pcmc);i++) {
+    if (store->entryc>=store->target_pcmc) break;
+    if (store->pcmtotal>=limit) break;
+    if (bbb_store_now_us()>=deadline) break;
+    uint32_t sndid=orderv[i].sndid;
+    if (bbb_store_search(store,sndid)>=0) continue;
+    struct bbb_pcm *pcm=bbb_store_get_pcm(0,store,sndid);
+    if (!pcm) continue;
+    bbb_pcm_del(pcm);
+    loadc++;
+  }
+  
+  store->profile=profile;
+  bb_free(orderv);
+  return loadc;
+}
+
+int bbb_store_prewarm(struct bbb_store *store,int pcmc,int bytec,int max_us) {
+  if (!store) return -1;
+  bbb_store_lock(store);
+  int err=bbb_store_prewarm_unlocked(store,pcmc,bytec,max_us);
+  bbb_store_unlock(store);
+  return err;
+}
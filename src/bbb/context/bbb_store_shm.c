@@ -0,0 +1,266 @@
+#include "bbb_context_internal.h"
+#include "share/bb_serial.h"
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Segment layout:
+ *   Header.
+ *   Index: (slotc) slots, open addressing with linear probing. Slots are claimed, never released.
+ *   Heap: Complete struct bbb_pcm records, 8-byte aligned, bump-allocated. Never freed.
+ * A slot's (sndid) is claimed by compare-and-swap from zero.
+ * Its (offset) stays zero until the record is completely written, then becomes the record's offset, with release.
+ * A claimed slot with zero offset is a miss: Someone else is writing it, or gave up.
+ * When the heap fills up, we just stop publishing.
+ */
+ 
+#define BBB_SHM_MAGIC 0x42424253484d3031ull /* "BBBSHM01" */
+#define BBB_SHM_SLOTC 16384 /* Must be a power of two. */
+#define BBB_SHM_SIZE_DEFAULT (64<<20)
+#define BBB_SHM_READY_TIMEOUT_MS 1000
+
+struct bbb_shm_header {
+  uint64_t magic;
+  uint64_t size;
+  uint32_t rate;
+  uint32_t slotc;
+  uint8_t digest[16];
+  _Atomic uint64_t heaptop; // Offset from the segment's start.
+  _Atomic uint32_t ready; // Set last by the creator.
+  uint32_t reserved;
+};
+
+struct bbb_shm_slot {
+  _Atomic uint32_t sndid;
+  _Atomic uint32_t offset;
+};
+
+#define HEADER ((struct bbb_shm_header*)shm->v)
+#define SLOTV ((struct bbb_shm_slot*)(shm->v+sizeof(struct bbb_shm_header)))
+
+/* Cleanup.
+ */
+ 
+void bbb_shm_del(struct bbb_shm *shm) {
+  if (!shm) return;
+  if (shm->v) munmap(shm->v,shm->size);
+  bb_free(shm);
+}
+
+/* Derive a name from the rate and archive digest.
+ */
+ 
+static int bbb_shm_default_name(char *dst,int dsta,struct bbb_store *store) {
+  uint8_t digest[16];
+  char hex[32];
+  bbb_store_get_archive_digest(digest,store);
+  if (bb_hexstring_encode(hex,sizeof(hex),digest,16)!=sizeof(hex)) return -1;
+  int dstc=snprintf(dst,dsta,"/bbb-%d-%.16s",bbb_context_get_rate(store->context),hex);
+  if ((dstc<1)||(dstc>=dsta)) return -1;
+  return dstc;
+}
+
+/* Wait for a segment someone else created to come ready.
+ * It might not even be sized yet.
+ */
+ 
+static int bbb_shm_wait_ready(int fd,uint64_t *size) {
+  struct timespec nap={0,1000000};
+  int i=BBB_SHM_READY_TIMEOUT_MS;
+  for (;i-->0;nanosleep(&nap,0)) {
+    struct stat st;
+    if (fstat(fd,&st)<0) return -1;
+    if (st.st_size<sizeof(struct bbb_shm_header)) continue;
+    struct bbb_shm_header *header=mmap(0,sizeof(struct bbb_shm_header),PROT_READ,MAP_SHARED,fd,0);
+    if (header==MAP_FAILED) return -1;
+    int ready=atomic_load_explicit(&header->ready,memory_order_acquire);
+    *size=header->size;
+    munmap(header,sizeof(struct bbb_shm_header));
+    if (ready) return 0;
+  }
+  return -1;
+}
+
+/* Open or create the segment.
+ */
+ 
+static struct bbb_shm *bbb_shm_open(struct bbb_store *store,const char *name,int size) {
+  if (size<=0) size=BBB_SHM_SIZE_DEFAULT;
+  int slotsize=sizeof(struct bbb_shm_slot)*BBB_SHM_SLOTC;
+  if (size<(int)sizeof(struct bbb_shm_header)+slotsize+(1<<16)) return 0;
+  
+  int created=1;
+  // Owner-only: Anyone who can write the segment can feed us anything.
+  int fd=shm_open(name,O_RDWR|O_CREAT|O_EXCL,0600);
+  if ((fd<0)&&(errno==EEXIST)) {
+    created=0;
+    fd=shm_open(name,O_RDWR,0600);
+  }
+  if (fd<0) return 0;
+  
+  uint64_t fullsize=size;
+  if (created) {
+    if (ftruncate(fd,fullsize)<0) {
+      close(fd);
+      shm_unlink(name);
+      return 0;
+    }
+  } else if (bbb_shm_wait_ready(fd,&fullsize)<0) {
+    close(fd);
+    return 0;
+  }
+  
+  struct bbb_shm *shm=bb_calloc(1,sizeof(struct bbb_shm));
+  if (!shm) {
+    close(fd);
+    return 0;
+  }
+  shm->size=fullsize;
+  shm->v=mmap(0,shm->size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+  close(fd);
+  if (shm->v==MAP_FAILED) {
+    shm->v=0;
+    bbb_shm_del(shm);
+    return 0;
+  }
+  
+  // Creator: Fresh pages are zeroed, so the index is already empty.
+  if (created) {
+    HEADER->magic=BBB_SHM_MAGIC;
+    HEADER->size=shm->size;
+    HEADER->rate=bbb_context_get_rate(store->context);
+    HEADER->slotc=BBB_SHM_SLOTC;
+    bbb_store_get_archive_digest(HEADER->digest,store);
+    atomic_store_explicit(&HEADER->heaptop,sizeof(struct bbb_shm_header)+slotsize,memory_order_relaxed);
+    atomic_store_explicit(&HEADER->ready,1,memory_order_release);
+    
+  // Everyone else: Validate it.
+  } else {
+    uint8_t digest[16];
+    bbb_store_get_archive_digest(digest,store);
+    if (
+      (HEADER->magic!=BBB_SHM_MAGIC)||
+      (HEADER->size!=shm->size)||
+      (HEADER->rate!=bbb_context_get_rate(store->context))||
+      (HEADER->slotc!=BBB_SHM_SLOTC)||
+      memcmp(HEADER->digest,digest,16)
+    ) {
+      bbb_shm_del(shm);
+      return 0;
+    }
+  }
+  return shm;
+}
+
+/* Attach, public.
+ */
+ 
+int bbb_store_attach_shm(struct bbb_store *store,const char *name,int size) {
+  if (!store) return -1;
+  char defname[64];
+  if (!name) {
+    if (bbb_shm_default_name(defname,sizeof(defname),store)<0) return -1;
+    name=defname;
+  }
+  bbb_store_lock(store);
+  int err=-1;
+  if (!store->shm&&(store->shm=bbb_shm_open(store,name,size))) err=0;
+  bbb_store_unlock(store);
+  return err;
+}
+
+int bbb_store_unlink_shm(struct bbb_store *store,const char *name) {
+  if (!store) return -1;
+  char defname[64];
+  if (!name) {
+    if (bbb_shm_default_name(defname,sizeof(defname),store)<0) return -1;
+    name=defname;
+  }
+  if (shm_unlink(name)<0) return -1;
+  return 0;
+}
+
+/* Lookup.
+ * Another process wrote the record, so check it fits the segment before handing it to anyone.
+ */
+ 
+static int bbb_shm_record_valid(const struct bbb_shm *shm,uint32_t offset) {
+  uint64_t heapstart=sizeof(struct bbb_shm_header)+sizeof(struct bbb_shm_slot)*BBB_SHM_SLOTC;
+  if ((offset<heapstart)||(offset&7)) return 0;
+  if (offset>shm->size-sizeof(struct bbb_pcm)) return 0;
+  const struct bbb_pcm *pcm=(struct bbb_pcm*)(shm->v+offset);
+  if (pcm->refc!=BBB_PCM_REFC_STATIC) return 0;
+  if ((pcm->c<1)||((uint64_t)pcm->c*sizeof(int16_t)>shm->size-offset-sizeof(struct bbb_pcm))) return 0;
+  if ((pcm->loopa<0)||(pcm->loopa>pcm->loopz)||(pcm->loopz>pcm->c)) return 0;
+  if (pcm->inprogress||(pcm->readyc!=pcm->c)) return 0;
+  return 1;
+}
+ 
+struct bbb_pcm *bbb_shm_get(struct bbb_shm *shm,uint32_t sndid) {
+  if (!shm||shm->stale||!sndid) return 0;
+  uint32_t mask=BBB_SHM_SLOTC-1;
+  uint32_t p=(sndid*2654435761u)&mask;
+  int i=BBB_SHM_SLOTC;
+  for (;i-->0;p=(p+1)&mask) {
+    struct bbb_shm_slot *slot=SLOTV+p;
+    uint32_t q=atomic_load_explicit(&slot->sndid,memory_order_acquire);
+    if (!q) return 0;
+    if (q!=sndid) continue;
+    uint32_t offset=atomic_load_explicit(&slot->offset,memory_order_acquire);
+    if (!offset) return 0;
+    if (!bbb_shm_record_valid(shm,offset)) return 0;
+    return (struct bbb_pcm*)(shm->v+offset);
+  }
+  return 0;
+}
+
+/* Publish.
+ */
+ 
+int bbb_shm_put(struct bbb_shm *shm,uint32_t sndid,const struct bbb_pcm *pcm) {
+  if (!shm||shm->stale||!sndid||!pcm||pcm->inprogress) return -1;
+  
+  // A pcm already in the segment, eg deduped to another sound, only needs a slot.
+  uint64_t offset=0,len=0;
+  if (((uint8_t*)pcm>shm->v)&&((uint8_t*)pcm<shm->v+shm->size)) {
+    offset=(uint8_t*)pcm-shm->v;
+  }
+  
+  // Claim a slot, or find that someone else already did.
+  uint32_t mask=BBB_SHM_SLOTC-1;
+  uint32_t p=(sndid*2654435761u)&mask;
+  struct bbb_shm_slot *slot=0;
+  int i=BBB_SHM_SLOTC;
+  for (;i-->0;p=(p+1)&mask) {
+    struct bbb_shm_slot *q=SLOTV+p;
+    uint32_t expect=0;
+    if (atomic_compare_exchange_strong_explicit(&q->sndid,&expect,sndid,memory_order_acq_rel,memory_order_acquire)) {
+      slot=q;
+      break;
+    }
+    if (expect==sndid) return 0;
+  }
+  if (!slot) return -1;
+  
+  // Allocate and fill the record. If we're out of room, the slot stays claimed and empty, that's fine.
+  if (!offset) {
+    len=(sizeof(struct bbb_pcm)+sizeof(int16_t)*pcm->c+7)&~7ull;
+    offset=atomic_fetch_add_explicit(&HEADER->heaptop,len,memory_order_relaxed);
+    if ((len>shm->size)||(offset>shm->size-len)||(offset>UINT32_MAX)) return -1;
+    struct bbb_pcm *dst=(struct bbb_pcm*)(shm->v+offset);
+    dst->refc=BBB_PCM_REFC_STATIC;
+    dst->c=pcm->c;
+    dst->loopa=pcm->loopa;
+    dst->loopz=pcm->loopz;
+    dst->inprogress=0;
+    dst->readyc=pcm->c;
+    dst->sndid=sndid;
+    memcpy(dst->v,pcm->v,sizeof(int16_t)*pcm->c);
+  }
+  atomic_store_explicit(&slot->offset,(uint32_t)offset,memory_order_release);
+  return 0;
+}
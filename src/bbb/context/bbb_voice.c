@@ -5,21 +5,35 @@
  
 void bbb_voice_cleanup(struct bbb_voice *voice) {
   bbb_pcm_del(voice->pcm);
+  bbb_printer_del(voice->printer);
 }
 
 /* Setup.
  */
 
-int bbb_voice_setup(struct bbb_voice *voice,int voiceid,struct bbb_pcm *pcm) {
+int bbb_voice_setup(struct bbb_voice *voice,int voiceid,struct bbb_pcm *pcm,struct bbb_printer *printer) {
   if (voiceid<0) return -1;
-  if (bbb_pcm_ref(pcm)<0) return -1;
+  if (printer&&(printer->pcm==pcm)&&pcm->inprogress) {
+    if (bbb_printer_ref(printer)<0) return -1;
+  } else {
+    printer=0;
+  }
+  if (bbb_pcm_ref(pcm)<0) {
+    bbb_printer_del(printer);
+    return -1;
+  }
   voice->pcm=pcm;
+  voice->printer=printer;
   if (voiceid&&(pcm->loopz>pcm->loopa)) {
     voice->voiceid=voiceid;
   } else {
     voice->voiceid=0;
   }
   voice->p=0;
+  voice->rate=BBB_VOICE_RATE_NORMAL;
+  voice->pfrac=0;
+  voice->gain=BBB_VOICE_GAIN_UNITY;
+  voice->level=BBB_VOICE_GAIN_UNITY;
   voice->chid=0xff;
   voice->noteid=0xff;
   return 0;
@@ -34,8 +48,106 @@ static inline void bbb_isignal_addv(int16_t *v,int c,const int16_t *a) {
   }
 }
 
+/* Above unity, a single voice can exceed the sample range, so we saturate.
+ * Straight and attenuated mixing wrap like they always have, it's cheaper.
+ */
+ 
+static inline void bbb_isignal_mix_sat(int16_t *v,int32_t a,int gain) {
+  int32_t n=(*v)+((a*gain)>>8);
+  if (n>32767) *v=32767;
+  else if (n<-32768) *v=-32768;
+  else *v=n;
+}
+
+static inline void bbb_isignal_addv_gain(int16_t *v,int c,const int16_t *a,int gain) {
+  if (gain>BBB_VOICE_GAIN_UNITY) {
+    for (;c-->0;v++,a++) bbb_isignal_mix_sat(v,*a,gain);
+  } else {
+    for (;c-->0;v++,a++) {
+      (*v)+=((*a)*gain)>>8;
+    }
+  }
+}
+
+/* (*gain) is u8.16, advancing by (step) each sample.
+ */
+ 
+static inline void bbb_isignal_addv_ramp(int16_t *v,int c,const int16_t *a,int32_t *gain,int32_t step) {
+  for (;c-->0;v++,a++) {
+    bbb_isignal_mix_sat(v,*a,(*gain)>>8);
+    (*gain)+=step;
+  }
+}
+
+/* Update with pitch shift.
+ * Same rules as normal update, but we step through the PCM at (rate) and interpolate linearly.
+ * Each output sample needs the next one too, so we stall one frame short of (readyc) while printing.
+ */
+ 
+static void bbb_voice_end(struct bbb_voice *voice) {
+  bbb_pcm_del(voice->pcm);
+  voice->pcm=0;
+  bbb_printer_del(voice->printer);
+  voice->printer=0;
+}
+
+static void bbb_voice_update_shifted(int16_t *v,int c,struct bbb_voice *voice,int32_t gain,int32_t step) {
+  struct bbb_pcm *pcm=voice->pcm;
+  
+  // Print enough for the whole update up front.
+  if (voice->printer) {
+    int64_t need=voice->p+((voice->pfrac+(uint64_t)voice->rate*c)>>16)+2;
+    if (need>pcm->c) need=pcm->c;
+    if (need>pcm->readyc) bbb_printer_update(voice->printer,need-pcm->readyc);
+    if (!pcm->inprogress) {
+      bbb_printer_del(voice->printer);
+      voice->printer=0;
+    }
+  }
+  
+  for (;c-->0;v++) {
+    int p=voice->p;
+    if (voice->voiceid) {
+      while (p>=pcm->loopz) p-=pcm->loopz-pcm->loopa;
+      voice->p=p;
+    } else if (p>=pcm->c) {
+      bbb_voice_end(voice);
+      return;
+    }
+    int q=p+1;
+    if (voice->voiceid&&(q>=pcm->loopz)) q=pcm->loopa;
+    if (pcm->inprogress&&(q>=pcm->readyc)) return;
+    int32_t a=pcm->v[p];
+    int32_t b=(q<pcm->c)?pcm->v[q]:0;
+    a+=((b-a)*(int32_t)(voice->pfrac>>1))>>15;
+    if (step) {
+      bbb_isignal_mix_sat(v,a,gain>>8);
+      gain+=step;
+    } else if (voice->gain>BBB_VOICE_GAIN_UNITY) {
+      bbb_isignal_mix_sat(v,a,voice->gain);
+    } else {
+      (*v)+=(a*voice->gain)>>8;
+    }
+    voice->pfrac+=voice->rate;
+    voice->p+=voice->pfrac>>16;
+    voice->pfrac&=0xffff;
+  }
+}
+
 void bbb_voice_update(int16_t *v,int c,struct bbb_voice *voice) {
-  if (!voice->pcm) return;
+  if (!voice->pcm||(c<1)) return;
+  
+  // Gain changed? Slide to it across this update, in u8.16.
+  int32_t gain=voice->level<<8,step=0;
+  if (voice->level!=voice->gain) {
+    step=((voice->gain-voice->level)*256)/c;
+    voice->level=voice->gain;
+  }
+  
+  if (voice->rate!=BBB_VOICE_RATE_NORMAL) {
+    bbb_voice_update_shifted(v,c,voice,gain,step);
+    return;
+  }
   while (c>0) {
     int cpc;
     if (voice->voiceid) {
@@ -49,13 +161,29 @@ void bbb_voice_update(int16_t *v,int c,struct bbb_voice *voice) {
       if (cpc<1) {
         bbb_pcm_del(voice->pcm);
         voice->pcm=0;
+        bbb_printer_del(voice->printer);
+        voice->printer=0;
         return;
       }
     }
     if (cpc>c) cpc=c;
+    
+    // Read only what's been printed. Print more if we can.
+    if (voice->p+cpc>voice->pcm->readyc) {
+      if (voice->printer) {
+        bbb_printer_update(voice->printer,voice->p+cpc-voice->pcm->readyc);
+      }
+      if (voice->p+cpc>voice->pcm->readyc) cpc=voice->pcm->readyc-voice->p;
+    }
+    if (voice->printer&&!voice->pcm->inprogress) {
+      bbb_printer_del(voice->printer);
+      voice->printer=0;
+    }
     if (cpc<1) return;
     
-    bbb_isignal_addv(v,cpc,voice->pcm->v+voice->p);
+    if (step) bbb_isignal_addv_ramp(v,cpc,voice->pcm->v+voice->p,&gain,step);
+    else if (voice->gain==BBB_VOICE_GAIN_UNITY) bbb_isignal_addv(v,cpc,voice->pcm->v+voice->p);
+    else bbb_isignal_addv_gain(v,cpc,voice->pcm->v+voice->p,voice->gain);
     voice->p+=cpc;
     v+=cpc;
     c-=cpc;
@@ -10,8 +10,9 @@ void bbb_printer_del(struct bbb_printer *printer) {
   if (printer->type->printer_del) printer->type->printer_del(printer);
   bbb_pcm_del(printer->pcm);
   bbb_program_del(printer->program);
+  pthread_mutex_destroy(&printer->mtx);
   
-  free(printer);
+  bb_free(printer);
 }
 
 /* Retain.
@@ -32,15 +33,20 @@ struct bbb_printer *bbb_print(struct bbb_program *program,uint8_t noteid,uint8_t
   if (!program) return 0;
   if (!program->type->printer_init) return 0;
   
-  struct bbb_printer *printer=calloc(1,program->type->printer_objlen);
+  struct bbb_printer *printer=bb_calloc(1,program->type->printer_objlen);
   if (!printer) return 0;
+  if (pthread_mutex_init(&printer->mtx,0)) {
+    bb_free(printer);
+    return 0;
+  }
   
   printer->type=program->type;
   printer->context=program->context;
   printer->refc=1;
   
   if (bbb_program_ref(program)<0) {
-    free(printer);
+    pthread_mutex_destroy(&printer->mtx);
+    bb_free(printer);
     return 0;
   }
   printer->program=program;
@@ -58,6 +64,7 @@ struct bbb_printer *bbb_print(struct bbb_program *program,uint8_t noteid,uint8_t
     return 0;
   }
   printer->pcm->inprogress=1;
+  printer->pcm->readyc=0;
   
   return printer;
 }
@@ -65,15 +72,34 @@ struct bbb_printer *bbb_print(struct bbb_program *program,uint8_t noteid,uint8_t
 /* Update.
  */
 
-int bbb_printer_update(struct bbb_printer *printer,int c) {
-  if (!printer||!printer->type->printer_update) return 0;
+static int bbb_printer_update_locked(struct bbb_printer *printer,int c) {
+  if (printer->failed) return -1;
   int remaining=printer->pcm->c-printer->p;
   if (c>remaining) c=remaining;
   if (c<1) {
     printer->pcm->inprogress=0;
     return 0;
   }
-  if (printer->type->printer_update(printer->pcm->v+printer->p,c,printer)<0) return -1;
+  if (printer->type->printer_update(printer->pcm->v+printer->p,c,printer)<0) {
+    // Unprinted remainder is zeroes, let voices play through it rather than stall.
+    printer->failed=1;
+    printer->pcm->inprogress=0;
+    printer->pcm->readyc=printer->pcm->c;
+    return -1;
+  }
   printer->p+=c;
+  printer->pcm->readyc=printer->p;
+  if (printer->p>=printer->pcm->c) {
+    printer->pcm->inprogress=0;
+    return 0;
+  }
   return 1;
 }
+
+int bbb_printer_update(struct bbb_printer *printer,int c) {
+  if (!printer||!printer->type->printer_update) return 0;
+  pthread_mutex_lock(&printer->mtx);
+  int err=bbb_printer_update_locked(printer,c);
+  pthread_mutex_unlock(&printer->mtx);
+  return err;
+}
@@ -7,7 +7,7 @@ void bbb_program_del(struct bbb_program *program) {
   if (!program) return;
   if (program->refc-->1) return;
   if (program->type->program_del) program->type->program_del(program);
-  free(program);
+  bb_free(program);
 }
 
 /* Retain.
@@ -34,7 +34,7 @@ struct bbb_program *bbb_program_new(struct bbb_context *context,struct bb_decode
     return 0;
   }
   
-  struct bbb_program *program=calloc(1,type->program_objlen);
+  struct bbb_program *program=bb_calloc(1,type->program_objlen);
   if (!program) return 0;
   
   program->type=type;
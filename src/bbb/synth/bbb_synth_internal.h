@@ -3,6 +3,7 @@
 
 #include "bbb/bbb.h"
 #include "share/bb_codec.h"
+#include "share/bb_alloc.h"
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
@@ -16,6 +17,8 @@ struct bbb_program_type {
   
   /* program_init() must consume exactly the length that bbb_measure_program() reported.
    * Its decoder begins at the payload, the leading type byte is not included.
+   * program_pack_sndid() is called only at install, once per noteid, and the store tabulates it.
+   * So it must not depend on pid, and velocity must only be masked, the same mask for each call.
    */
   void (*program_del)(struct bbb_program *program);
   int (*program_init)(struct bbb_program *program,struct bb_decoder *src);
@@ -31,7 +34,7 @@ struct bbb_program_type {
 struct bbb_program {
   const struct bbb_program_type *type;
   struct bbb_context *context; // WEAK
-  int refc;
+  _Atomic int refc;
 };
 
 // struct bbb_printer defined in the public header.
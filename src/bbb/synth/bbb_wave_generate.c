@@ -3,12 +3,33 @@
 #include <string.h>
 #include <stdio.h>
 
+/* Tables generated at build time by etc/tool/mktables.c.
+ * If they're missing, or built for a different wave size, we generate at runtime instead.
+ */
+#ifndef BBB_WAVE_TABLES_DISABLE
+  #if defined(__has_include)
+    #if __has_include("bbb/bbb_wave_tables.h")
+      #include "bbb/bbb_wave_tables.h"
+    #endif
+  #endif
+#endif
+#if defined(BBB_WAVE_TABLES_SIZE_BITS)&&(BBB_WAVE_TABLES_SIZE_BITS==BBB_WAVE_SIZE_BITS)
+  #define BBB_WAVE_TABLES 1
+#else
+  #define BBB_WAVE_TABLES 0
+#endif
+
 /* Sine.
  */
  
 void bbb_wave_generate_sine(int16_t *v,int c) {
+  #if BBB_WAVE_TABLES
+    if (c==BBB_WAVE_SIZE) {
+      memcpy(v,bbb_wave_table_sine,sizeof(bbb_wave_table_sine));
+      return;
+    }
+  #endif
   double p=0.0,dp=(M_PI*2.0f)/c;
-  int16_t lo=0,hi=0;
   for (;c-->0;v++,p+=dp) {
     *v=sin(p)*32760.0;
   }
@@ -63,6 +84,24 @@ void bbb_wave_generate_losaw(int16_t *v,int c,double base) {
   }
 }
 
+/* Standard waves, the ones store caches.
+ */
+ 
+int bbb_wave_generate_standard(int16_t *v,uint8_t shape) {
+  switch (shape) {
+    #if BBB_WAVE_TABLES
+      case BBB_SHAPE_SINE: memcpy(v,bbb_wave_table_sine,sizeof(bbb_wave_table_sine)); return 0;
+      case BBB_SHAPE_LOSQUARE: memcpy(v,bbb_wave_table_losquare,sizeof(bbb_wave_table_losquare)); return 0;
+      case BBB_SHAPE_LOSAW: memcpy(v,bbb_wave_table_losaw,sizeof(bbb_wave_table_losaw)); return 0;
+    #else
+      case BBB_SHAPE_SINE: bbb_wave_generate_sine(v,BBB_WAVE_SIZE); return 0;
+      case BBB_SHAPE_LOSQUARE: bbb_wave_generate_losquare(v,BBB_WAVE_SIZE,32000,0.15); return 0;
+      case BBB_SHAPE_LOSAW: bbb_wave_generate_losaw(v,BBB_WAVE_SIZE,150.0); return 0;
+    #endif
+  }
+  return -1;
+}
+
 /* Harmonics.
  */
  
@@ -17,6 +17,7 @@ struct bbb_program_cheapfx {
     struct bbb_env levelenv;
   } *configv;
   int configc,configa;
+  uint16_t configpv[256]; // Index+1 into (configv) by noteid, zero if absent. Populated at the end of init.
 };
 
 struct bbb_printer_cheapfx {
@@ -39,7 +40,7 @@ struct bbb_printer_cheapfx {
  */
  
 static void _cheapfx_program_del(struct bbb_program *program) {
-  if (PROGRAM->configv) free(PROGRAM->configv);
+  if (PROGRAM->configv) bb_free(PROGRAM->configv);
 }
 
 static void _cheapfx_printer_del(struct bbb_printer *printer) {
@@ -59,13 +60,14 @@ static int bbb_cheapfx_add_config(struct bbb_program *program,int noteid,struct
   if (PROGRAM->configc>=PROGRAM->configa) {
     int na=PROGRAM->configa+16;
     if (na>INT_MAX/sizeof(struct bbb_cheapfx_config)) return -1;
-    void *nv=realloc(PROGRAM->configv,sizeof(struct bbb_cheapfx_config)*na);
+    void *nv=bb_realloc(PROGRAM->configv,sizeof(struct bbb_cheapfx_config)*na);
     if (!nv) return -1;
     PROGRAM->configv=nv;
     PROGRAM->configa=na;
   }
   
   struct bbb_cheapfx_config *config=PROGRAM->configv+PROGRAM->configc++;
+  memset(config,0,sizeof(struct bbb_cheapfx_config)); // bbb_env_decode() expects zeroed envelopes.
   config->noteid=noteid;
   int n;
   if (bb_decode_intbe(&n,src,2)<0) return -1; config->pitch=n;
@@ -102,6 +104,12 @@ static int _cheapfx_program_init(struct bbb_program *program,struct bb_decoder *
     noteid++;
   }
   
+  const struct bbb_cheapfx_config *config=PROGRAM->configv;
+  int i=0;
+  for (;i<PROGRAM->configc;i++,config++) {
+    PROGRAM->configpv[config->noteid]=i+1;
+  }
+  
   return 0;
 }
 
@@ -109,17 +117,9 @@ static int _cheapfx_program_init(struct bbb_program *program,struct bb_decoder *
  */
  
 static struct bbb_cheapfx_config *bbb_cheapfx_get_config(const struct bbb_program *program,uint8_t noteid) {
-  if (PROGRAM->configc<1) return 0;
-  if (noteid<PROGRAM->configv[0].noteid) return 0;
-  if (noteid>PROGRAM->configv[PROGRAM->configc-1].noteid) return 0;
-  int lo=0,hi=PROGRAM->configc;
-  while (lo<hi) {
-    int ck=(lo+hi)>>1;
-         if (noteid<PROGRAM->configv[ck].noteid) hi=ck;
-    else if (noteid>PROGRAM->configv[ck].noteid) lo=ck+1;
-    else return PROGRAM->configv+ck;
-  }
-  return 0;
+  uint16_t p=PROGRAM->configpv[noteid];
+  if (!p) return 0;
+  return PROGRAM->configv+p-1;
 }
 
 /* Pack sndid.
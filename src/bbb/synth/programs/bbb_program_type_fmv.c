@@ -84,7 +84,7 @@ static int _fmv_printer_init(struct bbb_printer *printer,uint8_t noteid,uint8_t
   if (bbb_wave_ref(PPROG->wave)<0) return -1;
   PRINTER->wave=PPROG->wave;
   
-  PRINTER->cpd=(bb_hz_from_noteidv[noteid&0x7f]*4294967296.0)/printer->context->rate;
+  PRINTER->cpd=printer->context->notedpv[noteid&0x7f];
   PRINTER->mpd=(PPROG->rate*bb_hz_from_noteidv[noteid&0x7f]*4294967296.0)/printer->context->rate;
 
   memcpy(&PRINTER->levelenv,&PPROG->levelenv,sizeof(struct bbb_env));
@@ -82,7 +82,7 @@ static int _harm1_printer_init(struct bbb_printer *printer,uint8_t noteid,uint8_
 
   if (bbb_wave_ref(PPROG->wave)<0) return -1;
   PRINTER->wave=PPROG->wave;
-  PRINTER->dp=(bb_hz_from_noteidv[noteid&0x7f]*4294967296.0)/printer->context->rate;
+  PRINTER->dp=printer->context->notedpv[noteid&0x7f];
 
   memcpy(&PRINTER->env,&PPROG->env,sizeof(struct bbb_env));
   bbb_env_reset(&PRINTER->env,velocity);
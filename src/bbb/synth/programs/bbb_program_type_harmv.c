@@ -96,7 +96,7 @@ static int _harmv_printer_init(struct bbb_printer *printer,uint8_t noteid,uint8_
   PRINTER->wavea=PPROG->wavea;
   if (bbb_wave_ref(PPROG->waveb)<0) return -1;
   PRINTER->waveb=PPROG->waveb;
-  PRINTER->dp=(bb_hz_from_noteidv[noteid&0x7f]*4294967296.0)/printer->context->rate;
+  PRINTER->dp=printer->context->notedpv[noteid&0x7f];
 
   memcpy(&PRINTER->levelenv,&PPROG->levelenv,sizeof(struct bbb_env));
   memcpy(&PRINTER->mixenv,&PPROG->mixenv,sizeof(struct bbb_env));
@@ -106,10 +106,10 @@ static int _shape1_printer_init(struct bbb_printer *printer,uint8_t noteid,uint8
   if (PPROG->wave) {
     if (bbb_wave_ref(PPROG->wave)<0) return -1;
     PRINTER->wave=PPROG->wave;
-    PRINTER->wavedp=(bb_hz_from_noteidv[noteid&0x7f]*4294967296.0)/printer->context->rate;
+    PRINTER->wavedp=printer->context->notedpv[noteid&0x7f];
     PRINTER->dp=PRINTER->wavedp>>16; // we need this for some measurements below
   } else {
-    PRINTER->dp=(bb_hz_from_noteidv[noteid&0x7f]*0x10000)/printer->context->rate;
+    PRINTER->dp=printer->context->notedpv[noteid&0x7f]>>16;
   }
 
   memcpy(&PRINTER->env,&PPROG->env,sizeof(struct bbb_env));
@@ -20,6 +20,13 @@ struct bbb_program_split {
   
   // To avoid searching the whole list for sndid normalization purposes, we cache the effective velocity masks.
   uint8_t velmaskv[256];
+  
+  /* Likewise for printing, each noteid has a precomputed list of the ranges covering it.
+   * Ranges for (noteid) are (notesubv[notep[noteid]..notep[noteid+1]-1]).
+   * (rangev) doesn't change after init, so it's safe to point into it.
+   */
+  int notep[257];
+  struct bbb_split_range **notesubv;
 };
 
 struct bbb_printer_split {
@@ -40,18 +47,19 @@ static void bbb_split_range_cleanup(struct bbb_split_range *range) {
 }
  
 static void _split_program_del(struct bbb_program *program) {
+  if (PROGRAM->notesubv) bb_free(PROGRAM->notesubv);
   if (PROGRAM->rangev) {
     while (PROGRAM->rangec-->0) {
       bbb_split_range_cleanup(PROGRAM->rangev+PROGRAM->rangec);
     }
-    free(PROGRAM->rangev);
+    bb_free(PROGRAM->rangev);
   }
 }
 
 static void _split_printer_del(struct bbb_printer *printer) {
   if (PRINTER->subv) {
     while (PRINTER->subc-->0) bbb_printer_del(PRINTER->subv[PRINTER->subc]);
-    free(PRINTER->subv);
+    bb_free(PRINTER->subv);
   }
 }
 
@@ -69,7 +77,7 @@ static int bbb_split_add_range(
   if (PROGRAM->rangec>=PROGRAM->rangea) {
     int na=PROGRAM->rangea+8;
     if (na>INT_MAX/sizeof(struct bbb_split_range)) return -1;
-    void *nv=realloc(PROGRAM->rangev,sizeof(struct bbb_split_range)*na);
+    void *nv=bb_realloc(PROGRAM->rangev,sizeof(struct bbb_split_range)*na);
     if (!nv) return -1;
     PROGRAM->rangev=nv;
     PROGRAM->rangea=na;
@@ -130,6 +138,26 @@ static int _split_program_init(struct bbb_program *program,struct bb_decoder *sr
       }
     }
   }
+  
+  // Build per-note range lists: Count them, then fill in.
+  int notec[256]={0},subc=0,noteid;
+  for (range=PROGRAM->rangev,i=PROGRAM->rangec;i-->0;range++) {
+    int notei=range->notec;
+    for (noteid=range->srcnoteid;notei-->0;noteid++) notec[noteid]++;
+    subc+=range->notec;
+  }
+  for (noteid=0;noteid<256;noteid++) PROGRAM->notep[noteid+1]=PROGRAM->notep[noteid]+notec[noteid];
+  if (subc) {
+    if (!(PROGRAM->notesubv=bb_malloc(sizeof(void*)*subc))) return -1;
+    memset(notec,0,sizeof(notec));
+    struct bbb_split_range *fill=PROGRAM->rangev;
+    for (i=PROGRAM->rangec;i-->0;fill++) {
+      int notei=fill->notec;
+      for (noteid=fill->srcnoteid;notei-->0;noteid++) {
+        PROGRAM->notesubv[PROGRAM->notep[noteid]+notec[noteid]++]=fill;
+      }
+    }
+  }
 
   return 0;
 }
@@ -156,7 +184,7 @@ static int bbb_split_add_sub(
   if (PRINTER->subc>=PRINTER->suba) {
     int na=PRINTER->suba+4;
     if (na>INT_MAX/sizeof(void*)) return -1;
-    void *nv=realloc(PRINTER->subv,sizeof(void*)*na);
+    void *nv=bb_realloc(PRINTER->subv,sizeof(void*)*na);
     if (!nv) return -1;
     PRINTER->subv=nv;
     PRINTER->suba=na;
@@ -178,11 +206,10 @@ static int _split_printer_init(struct bbb_printer *printer,uint8_t noteid,uint8_
   }
   
   int framec=1;
-  struct bbb_split_range *range=PPROG->rangev;
-  int i=PPROG->rangec;
-  for (;i-->0;range++) {
-    if (range->srcnoteid>noteid) continue;
-    if (range->srcnoteid+range->notec<=noteid) continue;
+  struct bbb_split_range **rangep=PPROG->notesubv+PPROG->notep[noteid];
+  int i=PPROG->notep[noteid+1]-PPROG->notep[noteid];
+  for (;i-->0;rangep++) {
+    const struct bbb_split_range *range=*rangep;
     int subframec=bbb_split_add_sub(printer,range->program,noteid-range->srcnoteid+range->dstnoteid,velocity);
     if (subframec<0) return -1;
     if (subframec>framec) framec=subframec;
@@ -13,6 +13,7 @@ struct bbb_program_weedrums {
     uint8_t noteid,cls,tone,level,release;
   } *configv;
   int configc,configa;
+  uint16_t configpv[256]; // Index+1 into (configv) by noteid, zero if absent. Populated at the end of init.
 };
 
 struct bbb_printer_weedrums {
@@ -33,7 +34,7 @@ struct bbb_printer_weedrums {
  */
  
 static void _weedrums_program_del(struct bbb_program *program) {
-  if (PROGRAM->configv) free(PROGRAM->configv);
+  if (PROGRAM->configv) bb_free(PROGRAM->configv);
 }
 
 static void _weedrums_printer_del(struct bbb_printer *printer) {
@@ -52,7 +53,7 @@ static int bbb_weedrums_add_config(struct bbb_program *program,int noteid,uint8_
   if (PROGRAM->configc>=PROGRAM->configa) {
     int na=PROGRAM->configa+16;
     if (na>INT_MAX/sizeof(struct bbb_weedrums_config)) return -1;
-    void *nv=realloc(PROGRAM->configv,sizeof(struct bbb_weedrums_config)*na);
+    void *nv=bb_realloc(PROGRAM->configv,sizeof(struct bbb_weedrums_config)*na);
     if (!nv) return -1;
     PROGRAM->configv=nv;
     PROGRAM->configa=na;
@@ -93,6 +94,12 @@ static int _weedrums_program_init(struct bbb_program *program,struct bb_decoder
     noteid++;
   }
   
+  const struct bbb_weedrums_config *config=PROGRAM->configv;
+  int i=0;
+  for (;i<PROGRAM->configc;i++,config++) {
+    PROGRAM->configpv[config->noteid]=i+1;
+  }
+  
   return 0;
 }
 
@@ -100,17 +107,9 @@ static int _weedrums_program_init(struct bbb_program *program,struct bb_decoder
  */
  
 static struct bbb_weedrums_config *bbb_weedrums_get_config(const struct bbb_program *program,uint8_t noteid) {
-  if (PROGRAM->configc<1) return 0;
-  if (noteid<PROGRAM->configv[0].noteid) return 0;
-  if (noteid>PROGRAM->configv[PROGRAM->configc-1].noteid) return 0;
-  int lo=0,hi=PROGRAM->configc;
-  while (lo<hi) {
-    int ck=(lo+hi)>>1;
-         if (noteid<PROGRAM->configv[ck].noteid) hi=ck;
-    else if (noteid>PROGRAM->configv[ck].noteid) lo=ck+1;
-    else return PROGRAM->configv+ck;
-  }
-  return 0;
+  uint16_t p=PROGRAM->configpv[noteid];
+  if (!p) return 0;
+  return PROGRAM->configv+p-1;
 }
 
 /* Pack sndid.
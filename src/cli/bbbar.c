@@ -1,6 +1,7 @@
 #include "bb_cli.h"
 #include "bbb/bbb.h"
 #include "share/bb_fs.h"
+#include "share/bb_alloc.h"
 #include "share/bb_codec.h"
 #include "share/bb_serial.h"
 
@@ -235,7 +236,7 @@ static int barc_add_source(struct barc_context *context,const char *path,char ty
       return -1;
     }
     int err=barc_add_file(context,src,srcc);
-    free(src);
+    bb_free(src);
     return err;
   }
   
@@ -269,7 +270,8 @@ static int barc_finish(struct barc_context *context) {
     }
   }
 
-  if (bb_file_write(context->path,context->dst.v,context->dst.c)<0) {
+  // Replace, don't rewrite: Running programs may have the old one mapped, and reload it when it changes.
+  if (bb_file_write_atomic(context->path,context->dst.v,context->dst.c)<0) {
     fprintf(stderr,"%s: Failed to write file.\n",context->path);
     return -1;
   }
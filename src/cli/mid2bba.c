@@ -1,5 +1,6 @@
 #include "bb_cli.h"
 #include "share/bb_fs.h"
+#include "share/bb_alloc.h"
 #include "share/bb_codec.h"
 #include "share/bb_midi.h"
 
@@ -19,7 +20,7 @@ struct mid2bba_context {
 };
 
 static void mid2bba_context_cleanup(struct mid2bba_context *ctx) {
-  if (ctx->midi) free(ctx->midi);
+  if (ctx->midi) bb_free(ctx->midi);
   bb_encoder_cleanup(&ctx->dst);
   bb_midi_file_del(ctx->midifile);
   bb_midi_file_reader_del(ctx->reader);
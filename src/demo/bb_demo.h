@@ -33,10 +33,13 @@ struct bbb_context;
     .rate=BB_DEMO_RATE, \
     .chanc=BB_DEMO_CHANC, \
     .driver=BB_DEMO_DRIVER, \
+    .ahead_ms=BB_DEMO_AHEAD_MS, \
     .synth=BB_DEMO_SYNTH, \
     .report_performance=BB_DEMO_REPORT_PERFORMANCE, \
     .bbb_config_path=BB_DEMO_BBB_CONFIG_PATH, \
     .bbb_cache_path=BB_DEMO_BBB_CACHE_PATH, \
+    .bbb_snapshot_path=BB_DEMO_BBB_SNAPSHOT_PATH, \
+    .bbb_profile_path=BB_DEMO_BBB_PROFILE_PATH, \
     .midi_in=BB_DEMO_MIDI_IN, \
   };
   
@@ -44,10 +47,13 @@ struct bbb_context;
 #define BB_DEMO_RATE 44100 /* Main rate, Hertz. */
 #define BB_DEMO_CHANC 2 /* Main channel count (1,2) */
 #define BB_DEMO_DRIVER 1 /* Nonzero to initialize real output. */
+#define BB_DEMO_AHEAD_MS 0 /* Nonzero to render this far ahead of the driver, on a separate thread. */
 #define BB_DEMO_SYNTH 'a' /* Which synthesizer to initialize: 0,'a','b' */
 #define BB_DEMO_REPORT_PERFORMANCE 1 /* Report CPU usage at teardown. (distracting if you also do it) */
 #define BB_DEMO_BBB_CONFIG_PATH BB_MIDDIR"/demo/data/bbbar-001.bbbar"
 #define BB_DEMO_BBB_CACHE_PATH 0 /* Null by default, I expect most demos want a clean state. */
+#define BB_DEMO_BBB_SNAPSHOT_PATH 0 /* Store snapshot, loaded at init and saved at quit. */
+#define BB_DEMO_BBB_PROFILE_PATH 0 /* Usage profile, prewarms at init and records while running. */
 #define BB_DEMO_MIDI_IN 1
 
 // Globals, initialized for you according to the settings above.
@@ -71,10 +77,13 @@ struct bb_demo {
   int rate;
   int chanc;
   int driver;
+  int ahead_ms;
   char synth;
   int report_performance;
   const char *bbb_config_path;
   const char *bbb_cache_path;
+  const char *bbb_snapshot_path;
+  const char *bbb_profile_path;
   int midi_in;
 };
 
@@ -62,9 +62,22 @@ static void bb_demo_quit(int status) {
    */
   struct rusage rusage={0};
   getrusage(RUSAGE_SELF,&rusage);
+  
+  struct bb_driver_ahead_stats ahead={0};
+  int have_ahead=(bb_driver_ahead_get_stats(&ahead,demo_driver)>=0);
 
   bb_driver_del(demo_driver);
   bb_midi_driver_del(demo_midi_driver);
+  if (demo_bbb&&demo->bbb_snapshot_path&&!status) {
+    int pcmc=bbb_store_save_snapshot(bbb_context_get_store(demo_bbb),demo->bbb_snapshot_path);
+    if (pcmc<0) fprintf(stderr,"%s: Failed to save BBB snapshot.\n",demo->bbb_snapshot_path);
+    else fprintf(stderr,"%s: Saved %d PCMs.\n",demo->bbb_snapshot_path,pcmc);
+  }
+  if (demo_bbb&&demo->bbb_profile_path&&!status) {
+    if (bbb_store_save_profile(bbb_context_get_store(demo_bbb),demo->bbb_profile_path)<0) {
+      fprintf(stderr,"%s: Failed to save BBB profile.\n",demo->bbb_profile_path);
+    }
+  }
   bbb_context_del(demo_bbb);
   bb_midi_intake_cleanup(&demo_intake);
   
@@ -86,6 +99,12 @@ static void bb_demo_quit(int status) {
         elapsed_real,elapsed_cpu/elapsed_real
       );
     }
+    if (have_ahead) {
+      fprintf(stderr,
+        "Render-ahead: %d underruns. Lowest fill %d of %d frames since last check.\n",
+        ahead.underrunc,ahead.fillmin,ahead.capacity
+      );
+    }
   }
 }
 
@@ -173,7 +192,11 @@ static int bb_demo_init() {
   }
   
   if (demo->driver) {
-    if (!(demo_driver=bb_driver_new(0,demo->rate,demo->chanc,BB_SAMPLEFMT_SINT16,(void*)bb_demo_cb_pcm,0))) {
+    if (demo->ahead_ms>0) {
+      if (!(demo_driver=bb_driver_new_ahead(0,demo->rate,demo->chanc,BB_SAMPLEFMT_SINT16,demo->ahead_ms,(void*)bb_demo_cb_pcm,0))) {
+        return -1;
+      }
+    } else if (!(demo_driver=bb_driver_new(0,demo->rate,demo->chanc,BB_SAMPLEFMT_SINT16,(void*)bb_demo_cb_pcm,0))) {
       return -1;
     }
     if (demo_driver->samplefmt!=BB_SAMPLEFMT_SINT16) {
@@ -181,6 +204,7 @@ static int bb_demo_init() {
       return -1;
     }
     fprintf(stderr,"Using PCM-Out driver '%s'.\n",demo_driver->type->name);
+    if (demo->ahead_ms>0) fprintf(stderr,"Rendering %d ms ahead.\n",demo->ahead_ms);
   }
   
   if ((demo_rate!=demo->rate)||(demo_chanc!=demo->chanc)) {
@@ -201,6 +225,19 @@ static int bb_demo_init() {
           fprintf(stderr,"Using BBB with default config.\n");
         }
         if (demo->bbb_cache_path) fprintf(stderr,"Using BBB cache '%s'.\n",demo->bbb_cache_path);
+        if (demo->bbb_snapshot_path) {
+          int pcmc=bbb_store_load_snapshot(bbb_context_get_store(demo_bbb),demo->bbb_snapshot_path);
+          if (pcmc>=0) fprintf(stderr,"%s: Loaded %d PCMs.\n",demo->bbb_snapshot_path,pcmc);
+        }
+        if (demo->bbb_profile_path) {
+          struct bbb_store *store=bbb_context_get_store(demo_bbb);
+          if (bbb_store_load_profile(store,demo->bbb_profile_path)>0) {
+            double starttime=bb_demo_now();
+            int pcmc=bbb_store_prewarm(store,INT_MAX,INT_MAX,500000);
+            fprintf(stderr,"%s: Prewarmed %d PCMs in %.03f s.\n",demo->bbb_profile_path,pcmc,bb_demo_now()-starttime);
+          }
+          bbb_store_set_profiling(store,1);
+        }
       } break;
     default: fprintf(stderr,"Demo '%s' requested unknown synth '%c'.\n",demo->name,demo->synth); return -1;
   }
@@ -240,6 +277,7 @@ static int bb_demo_main() {
     int err=demo->update();
     if (demo_driver) bb_driver_unlock(demo_driver);
     if (err<=0) return err;
+    if (demo_bbb) bbb_context_idle(demo_bbb,2000); // Outside the driver's lock, so audio doesn't wait on it.
   }
   return 0;
 }
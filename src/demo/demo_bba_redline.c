@@ -1,6 +1,7 @@
 #include "bb_demo.h"
 #include "bba/bba.h"
 #include "share/bb_fs.h"
+#include "share/bb_alloc.h"
 #include <sys/resource.h>
 
 /* On greyskull, I'm seeing scores typically >1500x, and occasionally >2000x.
@@ -80,7 +81,7 @@ static int demo_bba_redline_init() {
     fprintf(stderr,"%s: No signal produced.\n",SONG_PATH);
   }
   
-  free(src);
+  bb_free(src);
   return 0;
 }
 
@@ -1,6 +1,7 @@
 #include "bb_demo.h"
 #include "bba/bba.h"
 #include "share/bb_fs.h"
+#include "share/bb_alloc.h"
 
 //#define SONG_PATH 0 /* use hard-coded demo song */
 //#define SONG_PATH BB_MIDDIR"/demo/data/song/001-anitra.bba"
@@ -26,7 +27,7 @@ static void *song=0;
 static int songc=0;
 
 static void demo_bba_song_quit() {
-  if (song) free(song);
+  if (song) bb_free(song);
   song=0;
   songc=0;
 }
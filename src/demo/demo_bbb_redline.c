@@ -1,6 +1,5 @@
 #include "bb_demo.h"
 #include "bbb/bbb.h"
-#include "share/bb_fs.h"
 #include "share/bb_midi.h"
 #include <sys/resource.h>
 
@@ -46,17 +45,9 @@ static int demo_bbb_redline_init() {
     return -1;
   }
 
-  void *src=0;
-  int srcc=bb_file_read(&src,SONG_PATH);
-  if (srcc<0) {
-    fprintf(stderr,"%s: Failed to read file\n",SONG_PATH);
-    return -1;
-  }
-  
-  struct bb_midi_file *file=bb_midi_file_new(src,srcc);
-  free(src);
+  struct bb_midi_file *file=bb_midi_file_map(SONG_PATH);
   if (!file) {
-    fprintf(stderr,"%s: Failed to decode MIDI file\n",SONG_PATH);
+    fprintf(stderr,"%s: Failed to read or decode MIDI file\n",SONG_PATH);
     return -1;
   }
   
@@ -1,6 +1,5 @@
 #include "bb_demo.h"
 #include "bbb/bbb.h"
-#include "share/bb_fs.h"
 #include "share/bb_midi.h"
 
 #define SONG_PATH "src/demo/data/song/001-anitra.mid"
@@ -17,6 +16,10 @@
 #undef BB_DEMO_SYNTH
 #define BB_DEMO_SYNTH 'b'
 
+// Music only, so latency doesn't matter.
+#undef BB_DEMO_AHEAD_MS
+#define BB_DEMO_AHEAD_MS 100
+
 //TODO Default instrument set.
 #undef BB_DEMO_BBB_CONFIG_PATH
 #define BB_DEMO_BBB_CONFIG_PATH 0
@@ -24,6 +27,12 @@
 //#undef BB_DEMO_BBB_CACHE_PATH
 //#define BB_DEMO_BBB_CACHE_PATH BB_MIDDIR"/bbbcache"
 
+//#undef BB_DEMO_BBB_SNAPSHOT_PATH
+//#define BB_DEMO_BBB_SNAPSHOT_PATH BB_MIDDIR"/bbbsnapshot"
+
+//#undef BB_DEMO_BBB_PROFILE_PATH
+//#define BB_DEMO_BBB_PROFILE_PATH BB_MIDDIR"/bbbprofile"
+
 static void demo_bbb_song_quit() {
 }
 
@@ -34,17 +43,9 @@ static int demo_bbb_song_init() {
     return -1;
   }
 
-  void *src=0;
-  int srcc=bb_file_read(&src,SONG_PATH);
-  if (srcc<0) {
-    fprintf(stderr,"%s: Failed to read file\n",SONG_PATH);
-    return -1;
-  }
-  
-  struct bb_midi_file *file=bb_midi_file_new(src,srcc);
-  free(src);
+  struct bb_midi_file *file=bb_midi_file_map(SONG_PATH);
   if (!file) {
-    fprintf(stderr,"%s: Failed to decode MIDI file\n",SONG_PATH);
+    fprintf(stderr,"%s: Failed to read or decode MIDI file\n",SONG_PATH);
     return -1;
   }
   
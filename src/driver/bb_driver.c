@@ -1,4 +1,5 @@
 #include "bb_driver.h"
+#include "share/bb_alloc.h"
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
@@ -28,7 +29,7 @@ void bb_driver_del(struct bb_driver *driver) {
   if (driver->refc-->1) return;
   if (driver->type->del) driver->type->del(driver);
   if (driver->type->singleton==driver) memset(driver,0,driver->type->objlen);
-  else free(driver);
+  else bb_free(driver);
 }
 
 /* Retain.
@@ -64,7 +65,7 @@ struct bb_driver *bb_driver_new(
   if (driver) {
     if (driver->refc) return 0;
   } else {
-    if (!(driver=calloc(1,type->objlen))) return 0;
+    if (!(driver=bb_calloc(1,type->objlen))) return 0;
   }
   
   driver->type=type;
@@ -68,6 +68,33 @@ const struct bb_driver_type *bb_driver_type_by_name(const char *name,int namec);
 // Tracks real time, triggers your callback synchronously at update, discards your output.
 extern const struct bb_driver_type bb_driver_type_silent;
 
+/* Render-ahead.
+ * Wraps a driver of (type), with a producer thread calling your callback to keep a ring (ms) ahead of the device.
+ * The device's own callback only copies out of the ring, without locking, so a slow render doesn't become an xrun.
+ * Use it exactly like the driver it wraps. Locking blocks the producer, not the device.
+ * This adds (ms) of latency: Good for music, not for sound effects.
+ */
+struct bb_driver *bb_driver_new_ahead(
+  const struct bb_driver_type *type,
+  int rate,int chanc,
+  int samplefmt,
+  int ms,
+  void (*cb)(void *v,int c,struct bb_driver *driver),
+  void *userdata
+);
+
+/* Fill levels in frames. (fillmin) is the lowest the device has seen since your last call.
+ * (underrunc) counts device callbacks that found the ring short, since creation.
+ * Fails if (driver) is not render-ahead.
+ */
+struct bb_driver_ahead_stats {
+  int capacity;
+  int fill;
+  int fillmin;
+  int underrunc;
+};
+int bb_driver_ahead_get_stats(struct bb_driver_ahead_stats *stats,struct bb_driver *driver);
+
 /* MIDI-In.
  ************************************************************/
  
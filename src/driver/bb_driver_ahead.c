@@ -0,0 +1,231 @@
+#include "bb_driver.h"
+#include "share/bb_alloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+/* Producer renders in chunks of this many frames.
+ * The ring's capacity is always a multiple of it, so a chunk never straddles the seam.
+ */
+#define BB_AHEAD_CHUNK_FRAMES 256
+
+/* Instance definition.
+ */
+ 
+struct bb_driver_ahead {
+  struct bb_driver hdr;
+  struct bb_driver *device;
+  
+  uint8_t *ring;
+  int samplesize; // bytes
+  int chunkc; // samples per chunk
+  int capacity; // samples
+  int sleepns; // Producer's nap when the ring is full, about half a chunk.
+  
+  /* (head) is written only by the producer and (tail) only by the device.
+   * Both count samples since the start, and never wrap in practice.
+   */
+  _Atomic uint64_t head;
+  _Atomic uint64_t tail;
+  _Atomic int primed; // Nonzero after the producer fills the ring the first time.
+  _Atomic int fillmin; // Lowest fill seen by the device since the last stats query, in samples.
+  _Atomic int underrunc;
+  
+  pthread_t thd;
+  int thdok;
+  pthread_mutex_t mtx;
+  int mtxok;
+  _Atomic int abort;
+};
+
+#define DRIVER ((struct bb_driver_ahead*)driver)
+
+/* Cleanup.
+ * Device first, so nobody is reading the ring when the producer stops.
+ */
+ 
+static void _bb_ahead_del(struct bb_driver *driver) {
+  bb_driver_del(DRIVER->device);
+  if (DRIVER->thdok) {
+    DRIVER->abort=1;
+    pthread_join(DRIVER->thd,0);
+  }
+  if (DRIVER->mtxok) pthread_mutex_destroy(&DRIVER->mtx);
+  if (DRIVER->ring) bb_free(DRIVER->ring);
+}
+
+/* Producer thread.
+ */
+ 
+static void *bb_ahead_thd(void *arg) {
+  struct bb_driver *driver=arg;
+  struct timespec nap={0,DRIVER->sleepns};
+  while (!DRIVER->abort) {
+    uint64_t head=atomic_load_explicit(&DRIVER->head,memory_order_relaxed);
+    uint64_t tail=atomic_load_explicit(&DRIVER->tail,memory_order_acquire);
+    int fill=(int)(head-tail);
+    if (fill>DRIVER->capacity-DRIVER->chunkc) {
+      atomic_store_explicit(&DRIVER->primed,1,memory_order_release);
+      nanosleep(&nap,0);
+      continue;
+    }
+    void *dst=DRIVER->ring+(head%DRIVER->capacity)*DRIVER->samplesize;
+    if (pthread_mutex_lock(&DRIVER->mtx)) return 0;
+    driver->cb(dst,DRIVER->chunkc,driver);
+    pthread_mutex_unlock(&DRIVER->mtx);
+    atomic_store_explicit(&DRIVER->head,head+DRIVER->chunkc,memory_order_release);
+  }
+  return 0;
+}
+
+/* Device callback: Copy out of the ring, never wait.
+ * If the ring runs short, the remainder is silence.
+ */
+ 
+static void bb_ahead_cb_device(void *v,int c,struct bb_driver *device) {
+  struct bb_driver *driver=device->userdata;
+  
+  // Until the producer fills the ring once, we might not even have a ring.
+  if (!atomic_load_explicit(&DRIVER->primed,memory_order_acquire)) {
+    memset(v,0,c*((device->samplefmt==BB_SAMPLEFMT_FLOAT)?sizeof(float):sizeof(int16_t)));
+    return;
+  }
+  
+  uint64_t tail=atomic_load_explicit(&DRIVER->tail,memory_order_relaxed);
+  uint64_t head=atomic_load_explicit(&DRIVER->head,memory_order_acquire);
+  int fill=(int)(head-tail);
+  
+  if (fill<atomic_load_explicit(&DRIVER->fillmin,memory_order_relaxed)) {
+    atomic_store_explicit(&DRIVER->fillmin,fill,memory_order_relaxed);
+  }
+  
+  int cpc=(fill<c)?fill:c;
+  uint8_t *dst=v;
+  int ringp=tail%DRIVER->capacity;
+  int headc=DRIVER->capacity-ringp;
+  if (headc>cpc) headc=cpc;
+  memcpy(dst,DRIVER->ring+ringp*DRIVER->samplesize,headc*DRIVER->samplesize);
+  if (headc<cpc) {
+    memcpy(dst+headc*DRIVER->samplesize,DRIVER->ring,(cpc-headc)*DRIVER->samplesize);
+  }
+  atomic_store_explicit(&DRIVER->tail,tail+cpc,memory_order_release);
+  
+  if (cpc<c) {
+    memset(dst+cpc*DRIVER->samplesize,0,(c-cpc)*DRIVER->samplesize);
+    atomic_fetch_add_explicit(&DRIVER->underrunc,1,memory_order_relaxed);
+  }
+}
+
+/* Update, lock, unlock.
+ */
+ 
+static int _bb_ahead_update(struct bb_driver *driver) {
+  return bb_driver_update(DRIVER->device);
+}
+
+static int _bb_ahead_lock(struct bb_driver *driver) {
+  if (pthread_mutex_lock(&DRIVER->mtx)) return -1;
+  return 0;
+}
+
+static int _bb_ahead_unlock(struct bb_driver *driver) {
+  if (pthread_mutex_unlock(&DRIVER->mtx)) return -1;
+  return 0;
+}
+
+/* Type definition.
+ * Not in the registry: It only makes sense wrapped around some other type.
+ */
+ 
+static const struct bb_driver_type bb_driver_type_ahead={
+  .name="ahead",
+  .objlen=sizeof(struct bb_driver_ahead),
+  .del=_bb_ahead_del,
+  .update=_bb_ahead_update,
+  .lock=_bb_ahead_lock,
+  .unlock=_bb_ahead_unlock,
+};
+
+/* Size the ring, now that the device has told us its format.
+ */
+ 
+static int bb_ahead_init(struct bb_driver *driver,int ms) {
+  switch (driver->samplefmt) {
+    case BB_SAMPLEFMT_SINT16: DRIVER->samplesize=2; break;
+    case BB_SAMPLEFMT_FLOAT: DRIVER->samplesize=4; break;
+    default: return -1;
+  }
+  int64_t framec=((int64_t)driver->rate*ms)/1000;
+  int chunkcount=(int)((framec+BB_AHEAD_CHUNK_FRAMES-1)/BB_AHEAD_CHUNK_FRAMES);
+  if (chunkcount<2) chunkcount=2;
+  DRIVER->chunkc=BB_AHEAD_CHUNK_FRAMES*driver->chanc;
+  if (chunkcount>INT_MAX/DRIVER->samplesize/DRIVER->chunkc) return -1;
+  DRIVER->capacity=chunkcount*DRIVER->chunkc;
+  if (!(DRIVER->ring=bb_calloc(DRIVER->capacity,DRIVER->samplesize))) return -1;
+  DRIVER->sleepns=(int)(((int64_t)BB_AHEAD_CHUNK_FRAMES*500000000)/driver->rate);
+  atomic_store(&DRIVER->fillmin,DRIVER->capacity);
+  
+  if (pthread_mutex_init(&DRIVER->mtx,0)) return -1;
+  DRIVER->mtxok=1;
+  if (pthread_create(&DRIVER->thd,0,bb_ahead_thd,driver)) return -1;
+  DRIVER->thdok=1;
+  
+  return 0;
+}
+
+/* New.
+ */
+ 
+struct bb_driver *bb_driver_new_ahead(
+  const struct bb_driver_type *type,
+  int rate,int chanc,
+  int samplefmt,
+  int ms,
+  void (*cb)(void *v,int c,struct bb_driver *driver),
+  void *userdata
+) {
+  if (ms<1) return 0;
+  if (!cb) return 0;
+  
+  struct bb_driver *driver=bb_calloc(1,sizeof(struct bb_driver_ahead));
+  if (!driver) return 0;
+  driver->type=&bb_driver_type_ahead;
+  driver->refc=1;
+  driver->cb=cb;
+  driver->userdata=userdata;
+  
+  // Device runs first, producing silence until we're primed.
+  if (!(DRIVER->device=bb_driver_new(type,rate,chanc,samplefmt,bb_ahead_cb_device,driver))) {
+    bb_driver_del(driver);
+    return 0;
+  }
+  driver->rate=DRIVER->device->rate;
+  driver->chanc=DRIVER->device->chanc;
+  driver->samplefmt=DRIVER->device->samplefmt;
+  
+  if (bb_ahead_init(driver,ms)<0) {
+    bb_driver_del(driver);
+    return 0;
+  }
+  return driver;
+}
+
+/* Instrumentation.
+ */
+ 
+int bb_driver_ahead_get_stats(struct bb_driver_ahead_stats *stats,struct bb_driver *driver) {
+  if (!stats||!driver) return -1;
+  if (driver->type!=&bb_driver_type_ahead) return -1;
+  int chanc=driver->chanc;
+  uint64_t tail=atomic_load_explicit(&DRIVER->tail,memory_order_relaxed);
+  uint64_t head=atomic_load_explicit(&DRIVER->head,memory_order_acquire);
+  stats->capacity=DRIVER->capacity/chanc;
+  stats->fill=(int)(head-tail)/chanc;
+  stats->fillmin=atomic_exchange_explicit(&DRIVER->fillmin,DRIVER->capacity,memory_order_relaxed)/chanc;
+  stats->underrunc=atomic_load_explicit(&DRIVER->underrunc,memory_order_relaxed);
+  return 0;
+}
@@ -72,7 +72,7 @@ static int bb_silent_update_us(struct bb_driver *driver,int64_t us) {
   int samplec=framec*driver->chanc;
   while (samplec>BB_SILENT_BUFFER_SIZE) {
     driver->cb(DRIVER->buffer,BB_SILENT_BUFFER_SIZE,driver);
-    framec-=BB_SILENT_BUFFER_SIZE;
+    samplec-=BB_SILENT_BUFFER_SIZE;
   }
   driver->cb(DRIVER->buffer,samplec,driver);
   
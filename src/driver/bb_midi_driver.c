@@ -1,4 +1,5 @@
 #include "bb_driver.h"
+#include "share/bb_alloc.h"
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
@@ -54,7 +55,7 @@ void bb_midi_driver_del(struct bb_midi_driver *driver) {
   if (driver->refc-->1) return;
   if (driver->type->del) driver->type->del(driver);
   if (driver->type->singleton==driver) memset(driver,0,driver->type->objlen);
-  else free(driver);
+  else bb_free(driver);
 }
 
 int bb_midi_driver_ref(struct bb_midi_driver *driver) {
@@ -78,7 +79,7 @@ struct bb_midi_driver *bb_midi_driver_new(
   if (driver) {
     if (driver->refc) return 0;
   } else {
-    if (!(driver=calloc(1,type->objlen))) return 0;
+    if (!(driver=bb_calloc(1,type->objlen))) return 0;
   }
   
   driver->refc=1;
@@ -1,4 +1,5 @@
 #include "driver/bb_driver.h"
+#include "share/bb_alloc.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <pthread.h>
@@ -40,7 +41,7 @@ static void _bb_alsa_del(struct bb_driver *audio) {
   pthread_mutex_destroy(&DRIVER->iomtx);
   if (DRIVER->hwparams) snd_pcm_hw_params_free(DRIVER->hwparams);
   if (DRIVER->alsa) snd_pcm_close(DRIVER->alsa);
-  if (DRIVER->buf) free(DRIVER->buf);
+  if (DRIVER->buf) bb_free(DRIVER->buf);
 }
 
 /* I/O thread.
@@ -100,7 +101,7 @@ static int _bb_alsa_init(struct bb_driver *audio) {
 
   DRIVER->bufc=BB_ALSA_BUFFER_SIZE;
   DRIVER->bufc_samples=DRIVER->bufc*audio->chanc;
-  if (!(DRIVER->buf=malloc(DRIVER->bufc_samples*sizeof(int16_t)))) return -1;
+  if (!(DRIVER->buf=bb_malloc(DRIVER->bufc_samples*sizeof(int16_t)))) return -1;
 
   pthread_mutexattr_t mattr;
   pthread_mutexattr_init(&mattr);
@@ -5,17 +5,17 @@
  
 void bb_ossmidi_device_cleanup(struct bb_ossmidi_device *device) {
   if (device->fd>=0) close(device->fd);
-  if (device->name) free(device->name);
+  if (device->name) bb_free(device->name);
 }
  
 static void _bb_ossmidi_del(struct bb_midi_driver *driver) {
   if (DRIVER->infd>=0) close(DRIVER->infd);
-  if (DRIVER->pollfdv) free(DRIVER->pollfdv);
+  if (DRIVER->pollfdv) bb_free(DRIVER->pollfdv);
   if (DRIVER->devicev) {
     while (DRIVER->devicec-->0) {
       bb_ossmidi_device_cleanup(DRIVER->devicev+DRIVER->devicec);
     }
-    free(DRIVER->devicev);
+    bb_free(DRIVER->devicev);
   }
 }
 
@@ -2,6 +2,7 @@
 #define BB_OSSMIDI_INTERNAL_H
 
 #include "driver/bb_driver.h"
+#include "share/bb_alloc.h"
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
@@ -59,7 +59,7 @@ static int bb_ossmidi_consider_file(struct bb_midi_driver *driver,const char *pa
   if (DRIVER->devicec>=DRIVER->devicea) {
     int na=DRIVER->devicea+4;
     if (na>INT_MAX/sizeof(struct bb_ossmidi_device)) return -1;
-    void *nv=realloc(DRIVER->devicev,sizeof(struct bb_ossmidi_device)*na);
+    void *nv=bb_realloc(DRIVER->devicev,sizeof(struct bb_ossmidi_device)*na);
     if (!nv) return -1;
     DRIVER->devicev=nv;
     DRIVER->devicea=na;
@@ -106,7 +106,7 @@ static int bb_ossmidi_add_pollfd(struct bb_midi_driver *driver,int fd) {
   if (DRIVER->pollfdc>=DRIVER->pollfda) {
     int na=DRIVER->pollfda+8;
     if (na>INT_MAX/sizeof(struct pollfd)) return -1;
-    void *nv=realloc(DRIVER->pollfdv,sizeof(struct pollfd)*na);
+    void *nv=bb_realloc(DRIVER->pollfdv,sizeof(struct pollfd)*na);
     if (!nv) return -1;
     DRIVER->pollfdv=nv;
     DRIVER->pollfda=na;
@@ -294,18 +294,18 @@ static int bb_ossmidi_find_device_name(char *dst,int dsta,int ossid,const char *
       readingdevices=1;
     }
   }
-  free(src);
+  bb_free(src);
   return -1;
 }
  
 static int bb_ossmidi_device_set_name(struct bb_ossmidi_device *device,const char *src,int srcc) {
   char *nv=0;
   if (srcc) {
-    if (!(nv=malloc(srcc+1))) return -1;
+    if (!(nv=bb_malloc(srcc+1))) return -1;
     memcpy(nv,src,srcc);
     nv[srcc]=0;
   }
-  if (device->name) free(device->name);
+  if (device->name) bb_free(device->name);
   device->name=nv;
   device->namec=srcc;
   return 0;
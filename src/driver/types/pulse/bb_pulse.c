@@ -116,7 +116,7 @@ static int bb_pulse_init_buffer(struct bb_driver *driver) {
   // Reduce to next multiple of channel count.
   DRIVER->bufa-=DRIVER->bufa%driver->chanc;
   
-  if (!(DRIVER->buf=malloc(sizeof(int16_t)*DRIVER->bufa))) {
+  if (!(DRIVER->buf=bb_malloc(sizeof(int16_t)*DRIVER->bufa))) {
     return -1;
   }
   
@@ -2,6 +2,7 @@
 #define BB_PULSE_INTERNAL_H
 
 #include "driver/bb_driver.h"
+#include "share/bb_alloc.h"
 #include <pthread.h>
 #include <pulse/pulseaudio.h>
 #include <pulse/simple.h>
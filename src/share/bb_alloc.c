@@ -0,0 +1,144 @@
+#include "bb_alloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+/* Every block is preceded by this, which keeps the caller's pointer 16-byte aligned.
+ */
+struct bb_alloc_header {
+  _Alignas(16) struct bb_allocator *allocator;
+  uint64_t size;
+};
+
+#define HEADER_SIZE sizeof(struct bb_alloc_header)
+
+/* Default allocator: The C library.
+ */
+ 
+static void *bb_libc_malloc(size_t c,struct bb_allocator *allocator) {
+  return malloc(c);
+}
+
+static void *bb_libc_realloc(void *v,size_t c,struct bb_allocator *allocator) {
+  return realloc(v,c);
+}
+
+static void bb_libc_free(void *v,struct bb_allocator *allocator) {
+  free(v);
+}
+
+static struct bb_allocator bb_allocator_libc={
+  .malloc=bb_libc_malloc,
+  .realloc=bb_libc_realloc,
+  .free=bb_libc_free,
+};
+
+static struct bb_allocator *_Atomic bb_allocator_global=0;
+static _Thread_local struct bb_allocator *bb_allocator_local=0;
+
+// Sum of all allocators.
+static struct bb_allocator bb_allocator_total={0};
+
+/* Install.
+ */
+ 
+int bb_set_allocator(struct bb_allocator *allocator) {
+  if (allocator&&!allocator->malloc) return -1;
+  atomic_store(&bb_allocator_global,allocator);
+  return 0;
+}
+
+struct bb_allocator *bb_use_allocator(struct bb_allocator *allocator) {
+  struct bb_allocator *prev=bb_allocator_local;
+  if (allocator&&!allocator->malloc) return prev;
+  bb_allocator_local=allocator;
+  return prev;
+}
+
+struct bb_allocator *bb_get_allocator(void) {
+  if (bb_allocator_local) return bb_allocator_local;
+  struct bb_allocator *allocator=atomic_load(&bb_allocator_global);
+  if (allocator) return allocator;
+  return &bb_allocator_libc;
+}
+
+/* Accounting.
+ */
+ 
+static void bb_alloc_account(struct bb_allocator *allocator,int64_t bytes,int64_t count) {
+  int64_t now=atomic_fetch_add_explicit(&allocator->bytes,bytes,memory_order_relaxed)+bytes;
+  atomic_fetch_add_explicit(&allocator->count,count,memory_order_relaxed);
+  int64_t peak=atomic_load_explicit(&allocator->peak,memory_order_relaxed);
+  while ((now>peak)&&!atomic_compare_exchange_weak_explicit(
+    &allocator->peak,&peak,now,memory_order_relaxed,memory_order_relaxed
+  )) ;
+}
+
+static void bb_alloc_account_both(struct bb_allocator *allocator,int64_t bytes,int64_t count) {
+  bb_alloc_account(allocator,bytes,count);
+  bb_alloc_account(&bb_allocator_total,bytes,count);
+}
+
+int bb_get_alloc_stats(struct bb_alloc_stats *stats,const struct bb_allocator *allocator) {
+  if (!stats) return -1;
+  if (!allocator) allocator=&bb_allocator_total;
+  stats->bytes=atomic_load_explicit(&allocator->bytes,memory_order_relaxed);
+  stats->count=atomic_load_explicit(&allocator->count,memory_order_relaxed);
+  stats->peak=atomic_load_explicit(&allocator->peak,memory_order_relaxed);
+  return 0;
+}
+
+/* Allocate.
+ */
+ 
+void *bb_malloc(size_t c) {
+  if (c>SIZE_MAX-HEADER_SIZE) return 0;
+  struct bb_allocator *allocator=bb_get_allocator();
+  struct bb_alloc_header *header=allocator->malloc(HEADER_SIZE+c,allocator);
+  if (!header) return 0;
+  header->allocator=allocator;
+  header->size=c;
+  bb_alloc_account_both(allocator,c,1);
+  return header+1;
+}
+
+void *bb_calloc(size_t c,size_t size) {
+  if (size&&(c>SIZE_MAX/size)) return 0;
+  void *v=bb_malloc(c*size);
+  if (!v) return 0;
+  memset(v,0,c*size);
+  return v;
+}
+
+/* Reallocate with the block's own allocator, which might not be the current one.
+ */
+ 
+void *bb_realloc(void *v,size_t c) {
+  if (!v) return bb_malloc(c);
+  if (c>SIZE_MAX-HEADER_SIZE) return 0;
+  struct bb_alloc_header *header=(struct bb_alloc_header*)v-1;
+  struct bb_allocator *allocator=header->allocator;
+  uint64_t pvsize=header->size;
+  struct bb_alloc_header *nheader;
+  if (allocator->realloc) {
+    if (!(nheader=allocator->realloc(header,HEADER_SIZE+c,allocator))) return 0;
+  } else {
+    if (!(nheader=allocator->malloc(HEADER_SIZE+c,allocator))) return 0;
+    memcpy(nheader,header,HEADER_SIZE+((pvsize<c)?pvsize:c));
+    if (allocator->free) allocator->free(header,allocator);
+  }
+  nheader->size=c;
+  bb_alloc_account_both(allocator,(int64_t)c-(int64_t)pvsize,0);
+  return nheader+1;
+}
+
+/* Free.
+ */
+ 
+void bb_free(void *v) {
+  if (!v) return;
+  struct bb_alloc_header *header=(struct bb_alloc_header*)v-1;
+  struct bb_allocator *allocator=header->allocator;
+  bb_alloc_account_both(allocator,-(int64_t)header->size,-1);
+  if (allocator->free) allocator->free(header,allocator);
+}
@@ -0,0 +1,64 @@
+/* bb_alloc.h
+ * Every heap allocation in bbb, share, and the drivers goes through here.
+ * bba never allocates.
+ * By default it's just the C library.
+ * Install your own allocator globally, or per thread (bbb contexts can carry one too, see bbb_context_set_allocator()).
+ * Each block remembers the allocator it came from and goes back to it, no matter who frees it, or when.
+ */
+ 
+#ifndef BB_ALLOC_H
+#define BB_ALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* (malloc) is required. It, and (realloc) if present, must return memory aligned to at least 16 bytes.
+ * We put a 16-byte header in front of each block, so that alignment is what callers get too.
+ * (realloc) is optional; without it we allocate, copy, and free.
+ * (free) is optional, eg for arenas that release in bulk.
+ * Accounting fields belong to us: Start them at zero and leave them alone.
+ * An allocator must outlive every block it produced.
+ */
+struct bb_allocator {
+  void *(*malloc)(size_t c,struct bb_allocator *allocator);
+  void *(*realloc)(void *v,size_t c,struct bb_allocator *allocator);
+  void (*free)(void *v,struct bb_allocator *allocator);
+  void *userdata;
+  _Atomic int64_t bytes,count,peak;
+};
+
+/* Global allocator for all threads, or null to restore the C library.
+ * Set it before creating anything.
+ */
+int bb_set_allocator(struct bb_allocator *allocator);
+
+/* Override the global allocator for the calling thread only, or null to stop overriding.
+ * Returns the previous override, so you can nest them.
+ */
+struct bb_allocator *bb_use_allocator(struct bb_allocator *allocator);
+
+// Whichever allocator the calling thread would use right now. Never null.
+struct bb_allocator *bb_get_allocator(void);
+
+/* Drop-in replacements for the C library functions.
+ * Never mix them: Something from bb_malloc() must be freed with bb_free(), and vice versa.
+ */
+void *bb_malloc(size_t c);
+void *bb_calloc(size_t c,size_t size);
+void *bb_realloc(void *v,size_t c);
+void bb_free(void *v);
+
+/* Accounting.
+ * (bytes) and (count) are the blocks currently outstanding, (peak) is the most (bytes) has ever been.
+ * Sizes are as requested, not counting our 16-byte header or the allocator's own overhead.
+ * (allocator) null for the sum of all allocators, including the C library default.
+ */
+struct bb_alloc_stats {
+  int64_t bytes;
+  int64_t count;
+  int64_t peak;
+};
+
+int bb_get_alloc_stats(struct bb_alloc_stats *stats,const struct bb_allocator *allocator);
+
+#endif
@@ -1,5 +1,6 @@
 #include "bb_codec.h"
 #include "bb_serial.h"
+#include "bb_alloc.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -10,7 +11,7 @@
  */
 
 void bb_encoder_cleanup(struct bb_encoder *encoder) {
-  if (encoder->v) free(encoder->v);
+  if (encoder->v) bb_free(encoder->v);
   memset(encoder,0,sizeof(struct bb_encoder));
 }
 
@@ -22,7 +23,7 @@ int bb_encoder_require(struct bb_encoder *encoder,int addc) {
   if (encoder->c>INT_MAX-addc) return -1;
   int na=encoder->c+addc;
   if (na<INT_MAX-256) na=(na+256)&~255;
-  void *nv=realloc(encoder->v,na);
+  void *nv=bb_realloc(encoder->v,na);
   if (!nv) return -1;
   encoder->v=nv;
   encoder->a=na;
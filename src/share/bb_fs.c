@@ -1,11 +1,14 @@
 #include "bb_fs.h"
+#include "bb_alloc.h"
 #include <string.h>
+#include <stdio.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 // This is for MS Windows compatibility.
 // Though... we're using '/' literally as path separator, so it will still be a challenge.
@@ -21,22 +24,25 @@
  
 static int bb_file_read_seekless(void *dstpp,int fd) {
   int dstc=0,dsta=8192;
-  char *dst=malloc(dsta);
+  char *dst=bb_malloc(dsta);
   if (!dst) return -1;
   while (1) {
     if (dstc>=dsta) {
-      if (dsta>=FS_SEEKLESS_SANITY_LIMIT) break;
+      if (dsta>=FS_SEEKLESS_SANITY_LIMIT) {
+        bb_free(dst);
+        return -1;
+      }
       dsta<<=1;
-      char *nv=malloc(dsta);
+      char *nv=bb_realloc(dst,dsta);
       if (!nv) {
-        free(dst);
+        bb_free(dst);
         return -1;
       }
       dst=nv;
     }
     int err=read(fd,dst+dstc,dsta-dstc);
     if (err<0) {
-      free(dst);
+      bb_free(dst);
       return -1;
     }
     if (!err) {
@@ -66,7 +72,7 @@ int bb_file_read(void *dstpp,const char *path) {
     return -1;
   }
   
-  char *dst=malloc(flen?flen:1);
+  char *dst=bb_malloc(flen?flen:1);
   if (!dst) {
     close(fd);
     return -1;
@@ -76,7 +82,7 @@ int bb_file_read(void *dstpp,const char *path) {
     int err=read(fd,dst+dstc,flen-dstc);
     if (err<=0) {
       close(fd);
-      free(dst);
+      bb_free(dst);
       return -1;
     }
     dstc+=err;
@@ -86,6 +92,30 @@ int bb_file_read(void *dstpp,const char *path) {
   return dstc;
 }
 
+/* Map file.
+ */
+ 
+int bb_file_map(void *dstpp,const char *path) {
+  if (!dstpp||!path) return -1;
+  int fd=open(path,O_RDONLY|O_BINARY);
+  if (fd<0) return -1;
+  off_t flen=lseek(fd,0,SEEK_END);
+  if ((flen<1)||(flen>INT_MAX)) {
+    close(fd);
+    return -1;
+  }
+  void *v=mmap(0,flen,PROT_READ,MAP_SHARED,fd,0);
+  close(fd); // The mapping stays valid after closing.
+  if (v==MAP_FAILED) return -1;
+  *(void**)dstpp=v;
+  return flen;
+}
+
+void bb_file_unmap(void *v,int c) {
+  if (!v||(c<1)) return;
+  munmap(v,c);
+}
+
 /* Write file.
  */
 
@@ -107,6 +137,23 @@ int bb_file_write(const char *path,const void *src,int srcc) {
   return 0;
 }
 
+int bb_file_write_atomic(const char *path,const void *src,int srcc) {
+  if (!path||(srcc<0)||(srcc&&!src)) return -1;
+  char tmppath[1024];
+  int tmppathc=snprintf(tmppath,sizeof(tmppath),"%s.%d.tmp",path,(int)getpid());
+  if ((tmppathc<1)||(tmppathc>=sizeof(tmppath))) return -1;
+  if (bb_file_write(tmppath,src,srcc)<0) return -1;
+  if (rename(tmppath,path)<0) {
+    // Windows won't rename over an existing file.
+    unlink(path);
+    if (rename(tmppath,path)<0) {
+      unlink(tmppath);
+      return -1;
+    }
+  }
+  return 0;
+}
+
 /* Read directory.
  */
  
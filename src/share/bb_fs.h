@@ -9,16 +9,32 @@
 /* Read entire file at once.
  * We'll try first to measure it by seeking.
  * If that fails, we'll retry progressively.
- * (*dstpp) is always allocated on success and you must free it, even if length is zero.
+ * (*dstpp) is always allocated on success and you must bb_free() it, even if length is zero.
  * If we report an error, we guarantee (*dstpp) was untouched.
  */
 int bb_file_read(void *dstpp,const char *path);
 
+/* Map entire file read-only, for as long as you like.
+ * Returns the length, and (*dstpp) points to the content.
+ * Release with bb_file_unmap(), with the same pointer and length.
+ * The mapping is shared: Other processes mapping the same file share its pages.
+ * Fails for empty files, and for anything the OS can't map, eg pipes. bb_file_read() is still an option then.
+ * Rewriting the file in place changes what the mapping shows, and shrinking it makes reads past the new end fault.
+ * Writers should replace it instead, see bb_file_write_atomic().
+ */
+int bb_file_map(void *dstpp,const char *path);
+void bb_file_unmap(void *v,int c);
+
 /* Write entire file at once.
  * Clobbers existing file, and deletes whatever's there if we fail midway.
  */
 int bb_file_write(const char *path,const void *src,int srcc);
 
+/* Same as bb_file_write(), but via a temporary file beside (path), renamed into place when complete.
+ * Readers see either the old file or the new one, never a partial one, and existing mappings keep the old content.
+ */
+int bb_file_write_atomic(const char *path,const void *src,int srcc);
+
 /* Call (cb) for each file immediately under directory (path).
  * (type) is zero if dirent doesn't provide it, otherwise see bb_file_get_type().
  * Terminates if (cb) returns nonzero, and returns the same.
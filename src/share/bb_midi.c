@@ -1,6 +1,8 @@
 #include "bb_midi.h"
 #include "bb_codec.h"
 #include "bb_serial.h"
+#include "bb_fs.h"
+#include "bb_alloc.h"
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
@@ -131,13 +133,19 @@ void bb_midi_file_del(struct bb_midi_file *file) {
   if (!file) return;
   if (file->refc-->1) return;
   if (file->trackv) {
-    while (file->trackc-->0) {
-      void *v=file->trackv[file->trackc].v;
-      if (v) free(v);
+    if (!file->borrowed) {
+      while (file->trackc-->0) {
+        void *v=file->trackv[file->trackc].v;
+        if (v) bb_free(v);
+      }
     }
-    free(file->trackv);
+    bb_free(file->trackv);
+  }
+  if (file->src) {
+    if (file->mapped) bb_file_unmap(file->src,file->srcc);
+    else bb_free(file->src);
   }
-  free(file);
+  bb_free(file);
 }
 
 /* Retain.
@@ -152,9 +160,10 @@ int bb_midi_file_ref(struct bb_midi_file *file) {
 }
 
 /* Receive MThd.
+ * (remaining) is the input length after this chunk, so we don't trust (track_count) beyond what it could hold.
  */
  
-static int bb_midi_file_decode_MThd(struct bb_midi_file *file,const uint8_t *src,int srcc) {
+static int bb_midi_file_decode_MThd(struct bb_midi_file *file,const uint8_t *src,int srcc,int remaining) {
 
   if (file->division) return -1; // Multiple MThd
   if (srcc<6) return -1; // Malformed MThd
@@ -166,6 +175,16 @@ static int bb_midi_file_decode_MThd(struct bb_midi_file *file,const uint8_t *src
   if (!file->division) return -1; // Division must be nonzero, both mathematically and because we use it as "MThd present" flag.
   if (file->division&0x8000) return -1; // SMPTE timing not supported (TODO?)
   // (format) must be 1, but I think we can take whatever.
+  
+  // Allocate the track list up front, if we're told how long it is. Every MTrk takes at least 8 bytes.
+  int na=file->track_count;
+  if (na>remaining>>3) na=remaining>>3;
+  if (na>file->tracka) {
+    void *nv=bb_realloc(file->trackv,sizeof(struct bb_midi_track)*na);
+    if (!nv) return -1;
+    file->trackv=nv;
+    file->tracka=na;
+  }
 
   return 0;
 }
@@ -178,15 +197,19 @@ static int bb_midi_file_decode_MTrk(struct bb_midi_file *file,const void *src,in
   if (file->trackc>=file->tracka) {
     int na=file->tracka+8;
     if (na>INT_MAX/sizeof(struct bb_midi_track)) return -1;
-    void *nv=realloc(file->trackv,sizeof(struct bb_midi_track)*na);
+    void *nv=bb_realloc(file->trackv,sizeof(struct bb_midi_track)*na);
     if (!nv) return -1;
     file->trackv=nv;
     file->tracka=na;
   }
   
-  void *nv=malloc(srcc?srcc:1);
-  if (!nv) return -1;
-  memcpy(nv,src,srcc);
+  void *nv;
+  if (file->borrowed) {
+    nv=(void*)src;
+  } else {
+    if (!(nv=bb_malloc(srcc?srcc:1))) return -1;
+    memcpy(nv,src,srcc);
+  }
   
   struct bb_midi_track *track=file->trackv+file->trackc++;
   track->v=nv;
@@ -223,7 +246,7 @@ static int bb_midi_file_decode(struct bb_midi_file *file,const void *src,int src
     if (bb_decode_intbe(&chunkid,&decoder,4)<0) return -1;
     if ((c=bb_decode_intbelen(&v,&decoder,4))<0) return -1;
     switch (chunkid) {
-      case ('M'<<24)|('T'<<16)|('h'<<8)|'d': if (bb_midi_file_decode_MThd(file,v,c)<0) return -1; break;
+      case ('M'<<24)|('T'<<16)|('h'<<8)|'d': if (bb_midi_file_decode_MThd(file,v,c,bb_decoder_remaining(&decoder))<0) return -1; break;
       case ('M'<<24)|('T'<<16)|('r'<<8)|'k': if (bb_midi_file_decode_MTrk(file,v,c)<0) return -1; break;
       default: if (bb_midi_file_decode_other(file,chunkid,v,c)<0) return -1;
     }
@@ -236,9 +259,22 @@ static int bb_midi_file_decode(struct bb_midi_file *file,const void *src,int src
  
 struct bb_midi_file *bb_midi_file_new(const void *src,int srcc) {
   if ((srcc<0)||(srcc&&!src)) return 0;
-  struct bb_midi_file *file=calloc(1,sizeof(struct bb_midi_file));
+  struct bb_midi_file *file=bb_calloc(1,sizeof(struct bb_midi_file));
+  if (!file) return 0;
+  file->refc=1;
+  if (bb_midi_file_decode(file,src,srcc)<0) {
+    bb_midi_file_del(file);
+    return 0;
+  }
+  return file;
+}
+
+struct bb_midi_file *bb_midi_file_new_borrow(const void *src,int srcc) {
+  if ((srcc<0)||(srcc&&!src)) return 0;
+  struct bb_midi_file *file=bb_calloc(1,sizeof(struct bb_midi_file));
   if (!file) return 0;
   file->refc=1;
+  file->borrowed=1;
   if (bb_midi_file_decode(file,src,srcc)<0) {
     bb_midi_file_del(file);
     return 0;
@@ -246,6 +282,29 @@ struct bb_midi_file *bb_midi_file_new(const void *src,int srcc) {
   return file;
 }
 
+/* New from file.
+ */
+ 
+struct bb_midi_file *bb_midi_file_map(const char *path) {
+  if (!path) return 0;
+  void *src=0;
+  int srcc=bb_file_map(&src,path),mapped=1;
+  if (srcc<1) {
+    if ((srcc=bb_file_read(&src,path))<0) return 0;
+    mapped=0;
+  }
+  struct bb_midi_file *file=bb_midi_file_new_borrow(src,srcc);
+  if (!file) {
+    if (mapped) bb_file_unmap(src,srcc);
+    else if (src) bb_free(src);
+    return 0;
+  }
+  file->src=src;
+  file->srcc=srcc;
+  file->mapped=mapped;
+  return file;
+}
+
 /* Object lifecycle.
  */
  
@@ -253,8 +312,8 @@ void bb_midi_file_reader_del(struct bb_midi_file_reader *reader) {
   if (!reader) return;
   if (reader->refc-->1) return;
   bb_midi_file_del(reader->file);
-  if (reader->trackv) free(reader->trackv);
-  free(reader);
+  if (reader->trackv) bb_free(reader->trackv);
+  bb_free(reader);
 }
 
 int bb_midi_file_reader_ref(struct bb_midi_file_reader *reader) {
@@ -270,7 +329,7 @@ int bb_midi_file_reader_ref(struct bb_midi_file_reader *reader) {
  
 static int bb_midi_file_reader_init_tracks(struct bb_midi_file_reader *reader) {
   reader->trackc=reader->file->trackc;
-  if (!(reader->trackv=calloc(sizeof(struct bb_midi_track_reader),reader->trackc))) return -1;
+  if (!(reader->trackv=bb_calloc(sizeof(struct bb_midi_track_reader),reader->trackc))) return -1;
   const struct bb_midi_track *ktrack=reader->file->trackv;
   struct bb_midi_track_reader *rtrack=reader->trackv;
   int i=reader->trackc;
@@ -286,7 +345,7 @@ static int bb_midi_file_reader_init_tracks(struct bb_midi_file_reader *reader) {
  
 struct bb_midi_file_reader *bb_midi_file_reader_new(struct bb_midi_file *file,int rate) {
   if (rate<1) return 0;
-  struct bb_midi_file_reader *reader=calloc(1,sizeof(struct bb_midi_file_reader));
+  struct bb_midi_file_reader *reader=bb_calloc(1,sizeof(struct bb_midi_file_reader));
   if (!reader) return 0;
   
   reader->refc=1;
@@ -586,7 +645,7 @@ int bb_midi_file_reader_is_complete(const struct bb_midi_file_reader *reader) {
  */
 
 void bb_midi_intake_cleanup(struct bb_midi_intake *intake) {
-  if (intake->devicev) free(intake->devicev);
+  if (intake->devicev) bb_free(intake->devicev);
   memset(intake,0,sizeof(struct bb_midi_intake));
 }
 
@@ -617,7 +676,7 @@ struct bb_midi_stream *bb_midi_intake_add_stream(struct bb_midi_intake *intake,c
   if (intake->devicec>=intake->devicea) {
     int na=intake->devicea+4;
     if (na>INT_MAX/sizeof(struct bb_midi_intake_device)) return 0;
-    void *nv=realloc(intake->devicev,sizeof(struct bb_midi_intake_device)*na);
+    void *nv=bb_realloc(intake->devicev,sizeof(struct bb_midi_intake_device)*na);
     if (!nv) return 0;
     intake->devicev=nv;
     intake->devicea=na;
@@ -106,6 +106,11 @@ struct bb_midi_file {
     int c;
   } *trackv;
   int trackc,tracka;
+  
+  int borrowed; // Tracks point into a buffer we don't own individually: Caller's, or (src).
+  void *src; // Only from bb_midi_file_map(): The whole file, which we own.
+  int srcc;
+  int mapped; // (src) is from bb_file_map(), otherwise bb_file_read().
 };
 
 struct bb_midi_file_reader {
@@ -132,6 +137,17 @@ void bb_midi_file_del(struct bb_midi_file *file);
 int bb_midi_file_ref(struct bb_midi_file *file);
 struct bb_midi_file *bb_midi_file_new(const void *src,int srcc);
 
+/* Decode without copying: Tracks point directly into (src).
+ * You must keep (src) alive and unchanged until the file is deleted, by everyone who holds a reference.
+ * That includes timelines and readers.
+ */
+struct bb_midi_file *bb_midi_file_new_borrow(const void *src,int srcc);
+
+/* Map a file from disk and decode it without copying, the file owns the mapping.
+ * If it can't be mapped, we read it instead, still one buffer for the whole thing.
+ */
+struct bb_midi_file *bb_midi_file_map(const char *path);
+
 void bb_midi_file_reader_del(struct bb_midi_file_reader *reader);
 int bb_midi_file_reader_ref(struct bb_midi_file_reader *reader);
 struct bb_midi_file_reader *bb_midi_file_reader_new(struct bb_midi_file *file,int rate);
@@ -157,4 +173,97 @@ int bb_midi_file_reader_advance(struct bb_midi_file_reader *reader,int framec);
 // To distinguish errors from EOF.
 int bb_midi_file_reader_is_complete(const struct bb_midi_file_reader *reader);
 
+/* Timeline.
+ * All tracks of a file merged into one array of events with absolute times, at a given rate.
+ * Compiling costs about as much as reading the whole file once.
+ * After that, reading is just walking the array, and repeats are free.
+ * Events' (v) point into the file, and the timeline holds a reference to it.
+ ********************************************************/
+ 
+struct bb_midi_timeline {
+  int refc;
+  int rate;
+  struct bb_midi_file *file;
+  struct bb_midi_timed_event {
+    int time; // frames from start of song
+    struct bb_midi_event event;
+  } *eventv;
+  int eventc,eventa;
+  int loopp; // Index of the first event after "BBx:START", or zero.
+  int looptime; // Time of "BBx:START", or zero.
+  int endtime; // Time of the last event.
+  
+  /* Channel programs as of event (p), recorded every BB_MIDI_TIMELINE_SNAPSHOT_INTERVAL events.
+   * Tempo and running status are already baked into the event times, programs are the only state worth tracking.
+   */
+  struct bb_midi_timeline_snapshot {
+    int p;
+    int usperqnote;
+    uint8_t programv[16];
+    uint16_t programmask; // Channels that have had a Program Change, (1<<chid).
+  } *snapshotv;
+  int snapshotc,snapshota;
+};
+
+#define BB_MIDI_TIMELINE_SNAPSHOT_INTERVAL 256
+
+struct bb_midi_timeline_reader {
+  int refc;
+  int repeat;
+  struct bb_midi_timeline *timeline;
+  int p; // Index of next event.
+  int now; // Current time, comparable to events' (time).
+  int tempo; // u16.16 multiplier, BB_MIDI_TEMPO_NORMAL to play as written.
+  int tempofrac; // Fraction of a frame carried between advances, in the same units.
+  int passc; // How many times we've returned to the loop point.
+};
+
+#define BB_MIDI_TEMPO_NORMAL 0x10000
+#define BB_MIDI_TEMPO_MIN    0x01000 /* 1/16 speed */
+#define BB_MIDI_TEMPO_MAX   0x100000 /* 16x speed */
+
+void bb_midi_timeline_del(struct bb_midi_timeline *timeline);
+int bb_midi_timeline_ref(struct bb_midi_timeline *timeline);
+struct bb_midi_timeline *bb_midi_timeline_new(struct bb_midi_file *file,int rate);
+
+void bb_midi_timeline_reader_del(struct bb_midi_timeline_reader *reader);
+int bb_midi_timeline_reader_ref(struct bb_midi_timeline_reader *reader);
+struct bb_midi_timeline_reader *bb_midi_timeline_reader_new(struct bb_midi_timeline *timeline);
+
+/* Same contract as bb_midi_file_reader_update() and bb_midi_file_reader_advance().
+ * Frame counts in and out are in output frames, ie scaled by (tempo).
+ */
+int bb_midi_timeline_reader_update(struct bb_midi_event *event,struct bb_midi_timeline_reader *reader);
+int bb_midi_timeline_reader_advance(struct bb_midi_timeline_reader *reader,int framec);
+int bb_midi_timeline_reader_is_complete(const struct bb_midi_timeline_reader *reader);
+
+/* Index of the first event at or after (time), or (eventc) if none.
+ */
+int bb_midi_timeline_search(const struct bb_midi_timeline *timeline,int time);
+
+/* Fill (dst) with the program for each of 16 channels, as of just before event (p).
+ * Channels with no Program Change yet are zero.
+ * Returns a mask of the channels that did have one, (1<<chid), so you can leave the others alone.
+ */
+int bb_midi_timeline_get_programs(uint8_t *dst,const struct bb_midi_timeline *timeline,int p);
+
+/* Time a reader resets to when it returns to the loop point. Fails if it can't repeat.
+ * Each pass after the first runs from here to (endtime). Can be -1, if the loop's first event is at zero.
+ */
+int bb_midi_timeline_get_repeat_time(int *time,const struct bb_midi_timeline *timeline);
+
+// Microseconds per quarter note as written, in effect just before event (p).
+int bb_midi_timeline_get_usperqnote(const struct bb_midi_timeline *timeline,int p);
+
+/* Change playback speed, effective immediately. Out of range is clamped.
+ * Returns the new tempo.
+ */
+int bb_midi_timeline_reader_set_tempo(struct bb_midi_timeline_reader *reader,int tempo);
+
+/* Move the playhead to (time) without reporting any of the skipped events.
+ * Times beyond the end are clamped to the end.
+ * If you need channel state as of the new position, see bb_midi_timeline_get_programs(reader->p).
+ */
+int bb_midi_timeline_reader_seek(struct bb_midi_timeline_reader *reader,int time);
+
 #endif
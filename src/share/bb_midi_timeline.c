@@ -0,0 +1,348 @@
+#include "bb_midi.h"
+#include "bb_alloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+/* Object lifecycle.
+ */
+ 
+void bb_midi_timeline_del(struct bb_midi_timeline *timeline) {
+  if (!timeline) return;
+  if (timeline->refc-->1) return;
+  bb_midi_file_del(timeline->file);
+  if (timeline->eventv) bb_free(timeline->eventv);
+  if (timeline->snapshotv) bb_free(timeline->snapshotv);
+  bb_free(timeline);
+}
+
+int bb_midi_timeline_ref(struct bb_midi_timeline *timeline) {
+  if (!timeline) return -1;
+  if (timeline->refc<1) return -1;
+  if (timeline->refc==INT_MAX) return -1;
+  timeline->refc++;
+  return 0;
+}
+
+/* Append event.
+ */
+ 
+static int bb_midi_timeline_append(struct bb_midi_timeline *timeline,int time,const struct bb_midi_event *event) {
+  if (timeline->eventc>=timeline->eventa) {
+    int na=timeline->eventa?(timeline->eventa<<1):256;
+    if (na>INT_MAX/sizeof(struct bb_midi_timed_event)) return -1;
+    void *nv=bb_realloc(timeline->eventv,sizeof(struct bb_midi_timed_event)*na);
+    if (!nv) return -1;
+    timeline->eventv=nv;
+    timeline->eventa=na;
+  }
+  struct bb_midi_timed_event *dst=timeline->eventv+timeline->eventc++;
+  dst->time=time;
+  dst->event=*event;
+  return 0;
+}
+
+/* Append a snapshot of (programv) as of the next event.
+ */
+ 
+static int bb_midi_timeline_snapshot(struct bb_midi_timeline *timeline,int usperqnote,const uint8_t *programv,uint16_t programmask) {
+  if (timeline->snapshotc>=timeline->snapshota) {
+    int na=timeline->snapshota?(timeline->snapshota<<1):32;
+    if (na>INT_MAX/sizeof(struct bb_midi_timeline_snapshot)) return -1;
+    void *nv=bb_realloc(timeline->snapshotv,sizeof(struct bb_midi_timeline_snapshot)*na);
+    if (!nv) return -1;
+    timeline->snapshotv=nv;
+    timeline->snapshota=na;
+  }
+  struct bb_midi_timeline_snapshot *snapshot=timeline->snapshotv+timeline->snapshotc++;
+  snapshot->p=timeline->eventc;
+  snapshot->usperqnote=usperqnote;
+  memcpy(snapshot->programv,programv,16);
+  snapshot->programmask=programmask;
+  return 0;
+}
+
+/* Set Tempo payload, or zero if malformed.
+ */
+ 
+static int bb_midi_timeline_decode_tempo(const struct bb_midi_event *event) {
+  if (event->c!=3) return 0;
+  const uint8_t *B=event->v;
+  return (B[0]<<16)|(B[1]<<8)|B[2];
+}
+
+/* Compile.
+ * We run the streaming reader to completion, so timing and event order are exactly what it would produce.
+ */
+ 
+static int bb_midi_timeline_compile(struct bb_midi_timeline *timeline) {
+  struct bb_midi_file_reader *reader=bb_midi_file_reader_new(timeline->file,timeline->rate);
+  if (!reader) return -1;
+  int now=0;
+  int usperqnote=500000;
+  uint8_t programv[16]={0};
+  uint16_t programmask=0;
+  while (1) {
+    struct bb_midi_event event={0};
+    int delay=bb_midi_file_reader_update(&event,reader);
+    if (delay<0) break;
+    if (delay) {
+      if (now>INT_MAX-delay) break;
+      now+=delay;
+      if (bb_midi_file_reader_advance(reader,delay)<0) break;
+      continue;
+    }
+    if (!(timeline->eventc%BB_MIDI_TIMELINE_SNAPSHOT_INTERVAL)) {
+      if (bb_midi_timeline_snapshot(timeline,usperqnote,programv,programmask)<0) {
+        bb_midi_file_reader_del(reader);
+        return -1;
+      }
+    }
+    if (bb_midi_timeline_append(timeline,now,&event)<0) {
+      bb_midi_file_reader_del(reader);
+      return -1;
+    }
+    if (event.opcode==BB_MIDI_OPCODE_PROGRAM) {
+      programv[event.chid&15]=event.a;
+      programmask|=1<<(event.chid&15);
+    } else if ((event.opcode==BB_MIDI_OPCODE_META)&&(event.a==0x51)) {
+      int v=bb_midi_timeline_decode_tempo(&event);
+      if (v) usperqnote=v;
+    }
+    // Highly nonstandard loop declaration, same as the streaming reader.
+    if ((event.opcode==BB_MIDI_OPCODE_SYSEX)&&(event.c==9)&&!memcmp(event.v,"BBx:START",9)) {
+      timeline->loopp=timeline->eventc;
+      timeline->looptime=now;
+    }
+  }
+  bb_midi_file_reader_del(reader);
+  timeline->endtime=now;
+  return 0;
+}
+
+/* New.
+ */
+ 
+struct bb_midi_timeline *bb_midi_timeline_new(struct bb_midi_file *file,int rate) {
+  if (rate<1) return 0;
+  struct bb_midi_timeline *timeline=bb_calloc(1,sizeof(struct bb_midi_timeline));
+  if (!timeline) return 0;
+  
+  timeline->refc=1;
+  timeline->rate=rate;
+  
+  if (bb_midi_file_ref(file)<0) {
+    bb_midi_timeline_del(timeline);
+    return 0;
+  }
+  timeline->file=file;
+  
+  if (bb_midi_timeline_compile(timeline)<0) {
+    bb_midi_timeline_del(timeline);
+    return 0;
+  }
+  
+  return timeline;
+}
+
+/* Reader lifecycle.
+ */
+ 
+void bb_midi_timeline_reader_del(struct bb_midi_timeline_reader *reader) {
+  if (!reader) return;
+  if (reader->refc-->1) return;
+  bb_midi_timeline_del(reader->timeline);
+  bb_free(reader);
+}
+
+int bb_midi_timeline_reader_ref(struct bb_midi_timeline_reader *reader) {
+  if (!reader) return -1;
+  if (reader->refc<1) return -1;
+  if (reader->refc==INT_MAX) return -1;
+  reader->refc++;
+  return 0;
+}
+
+struct bb_midi_timeline_reader *bb_midi_timeline_reader_new(struct bb_midi_timeline *timeline) {
+  struct bb_midi_timeline_reader *reader=bb_calloc(1,sizeof(struct bb_midi_timeline_reader));
+  if (!reader) return 0;
+  reader->refc=1;
+  reader->tempo=BB_MIDI_TEMPO_NORMAL;
+  if (bb_midi_timeline_ref(timeline)<0) {
+    bb_free(reader);
+    return 0;
+  }
+  reader->timeline=timeline;
+  return reader;
+}
+
+/* Convert a song-time interval to output frames, rounding up.
+ * Advancing by the result always reaches the target.
+ */
+ 
+static int bb_midi_timeline_reader_scale_delay(const struct bb_midi_timeline_reader *reader,int songframec) {
+  if (reader->tempo==BB_MIDI_TEMPO_NORMAL) return songframec;
+  int64_t n=((int64_t)songframec<<16)-reader->tempofrac;
+  int64_t framec=(n+reader->tempo-1)/reader->tempo;
+  if (framec<1) return 1;
+  if (framec>INT_MAX) return INT_MAX;
+  return framec;
+}
+
+/* Change tempo.
+ */
+ 
+int bb_midi_timeline_reader_set_tempo(struct bb_midi_timeline_reader *reader,int tempo) {
+  if (!reader) return -1;
+  if (tempo<BB_MIDI_TEMPO_MIN) tempo=BB_MIDI_TEMPO_MIN;
+  else if (tempo>BB_MIDI_TEMPO_MAX) tempo=BB_MIDI_TEMPO_MAX;
+  reader->tempo=tempo;
+  return tempo;
+}
+
+/* Where each repeat begins.
+ */
+ 
+int bb_midi_timeline_get_repeat_time(int *time,const struct bb_midi_timeline *timeline) {
+  if (!timeline) return -1;
+  if (timeline->loopp>=timeline->eventc) return -1;
+  int firsttime=timeline->eventv[timeline->loopp].time;
+  if (firsttime>timeline->looptime) *time=timeline->looptime;
+  else *time=firsttime-1;
+  return 0;
+}
+
+/* Next event.
+ */
+ 
+int bb_midi_timeline_reader_update(struct bb_midi_event *event,struct bb_midi_timeline_reader *reader) {
+  const struct bb_midi_timeline *timeline=reader->timeline;
+  
+  // At the end, either stop or return to the loop point.
+  // The loop's first event comes as long after the last event as it did after the loop point, at least one frame.
+  if (reader->p>=timeline->eventc) {
+    if (!reader->repeat) return -1;
+    int now;
+    if (bb_midi_timeline_get_repeat_time(&now,timeline)<0) return -1;
+    reader->p=timeline->loopp;
+    reader->now=now;
+    reader->tempofrac=0;
+    reader->passc++;
+  }
+  
+  const struct bb_midi_timed_event *next=timeline->eventv+reader->p;
+  if (next->time>reader->now) return bb_midi_timeline_reader_scale_delay(reader,next->time-reader->now);
+  *event=next->event;
+  reader->p++;
+  return 0;
+}
+
+/* Advance clock.
+ */
+ 
+int bb_midi_timeline_reader_advance(struct bb_midi_timeline_reader *reader,int framec) {
+  if (framec<0) return -1;
+  const struct bb_midi_timeline *timeline=reader->timeline;
+  if (reader->p<timeline->eventc) {
+    int songframec=timeline->eventv[reader->p].time-reader->now;
+    if (songframec<0) songframec=0;
+    if (framec>bb_midi_timeline_reader_scale_delay(reader,songframec)) return -1;
+  }
+  if (reader->tempo==BB_MIDI_TEMPO_NORMAL) {
+    reader->now+=framec;
+  } else {
+    int64_t n=(int64_t)framec*reader->tempo+reader->tempofrac;
+    reader->now+=n>>16;
+    reader->tempofrac=n&0xffff;
+  }
+  return 0;
+}
+
+/* Search by time.
+ */
+ 
+int bb_midi_timeline_search(const struct bb_midi_timeline *timeline,int time) {
+  int lo=0,hi=timeline->eventc;
+  while (lo<hi) {
+    int ck=(lo+hi)>>1;
+    if (timeline->eventv[ck].time<time) lo=ck+1;
+    else hi=ck;
+  }
+  return lo;
+}
+
+/* Channel programs at a given position.
+ * Start from the nearest snapshot and replay at most one interval's worth of events.
+ */
+ 
+int bb_midi_timeline_get_programs(uint8_t *dst,const struct bb_midi_timeline *timeline,int p) {
+  if (!dst||!timeline) return -1;
+  if (p<0) p=0;
+  else if (p>timeline->eventc) p=timeline->eventc;
+  int snapshotp=p/BB_MIDI_TIMELINE_SNAPSHOT_INTERVAL;
+  if (snapshotp>=timeline->snapshotc) snapshotp=timeline->snapshotc-1;
+  int eventp=0,mask=0;
+  if (snapshotp>=0) {
+    const struct bb_midi_timeline_snapshot *snapshot=timeline->snapshotv+snapshotp;
+    memcpy(dst,snapshot->programv,16);
+    mask=snapshot->programmask;
+    eventp=snapshot->p;
+  } else {
+    memset(dst,0,16);
+  }
+  const struct bb_midi_timed_event *event=timeline->eventv+eventp;
+  for (;eventp<p;eventp++,event++) {
+    if (event->event.opcode==BB_MIDI_OPCODE_PROGRAM) {
+      dst[event->event.chid&15]=event->event.a;
+      mask|=1<<(event->event.chid&15);
+    }
+  }
+  return mask;
+}
+
+/* Tempo at a given position, same idea as programs.
+ */
+ 
+int bb_midi_timeline_get_usperqnote(const struct bb_midi_timeline *timeline,int p) {
+  if (!timeline) return 0;
+  if (p<0) p=0;
+  else if (p>timeline->eventc) p=timeline->eventc;
+  int snapshotp=p/BB_MIDI_TIMELINE_SNAPSHOT_INTERVAL;
+  if (snapshotp>=timeline->snapshotc) snapshotp=timeline->snapshotc-1;
+  int usperqnote=500000,eventp=0;
+  if (snapshotp>=0) {
+    usperqnote=timeline->snapshotv[snapshotp].usperqnote;
+    eventp=timeline->snapshotv[snapshotp].p;
+  }
+  const struct bb_midi_timed_event *event=timeline->eventv+eventp;
+  for (;eventp<p;eventp++,event++) {
+    if ((event->event.opcode==BB_MIDI_OPCODE_META)&&(event->event.a==0x51)) {
+      int v=bb_midi_timeline_decode_tempo(&event->event);
+      if (v) usperqnote=v;
+    }
+  }
+  return usperqnote;
+}
+
+/* Seek.
+ */
+ 
+int bb_midi_timeline_reader_seek(struct bb_midi_timeline_reader *reader,int time) {
+  if (!reader) return -1;
+  const struct bb_midi_timeline *timeline=reader->timeline;
+  if (time<0) time=0;
+  else if (time>timeline->endtime) time=timeline->endtime;
+  reader->p=bb_midi_timeline_search(timeline,time);
+  reader->now=time;
+  reader->tempofrac=0;
+  reader->passc=0;
+  return 0;
+}
+
+/* Check completion.
+ */
+ 
+int bb_midi_timeline_reader_is_complete(const struct bb_midi_timeline_reader *reader) {
+  if (!reader) return 0;
+  return (reader->p>=reader->timeline->eventc);
+}